@@ -0,0 +1,127 @@
+#include "CameraStream.h"
+#include "Lazurite_Packet.h"
+#include "DebugUtils.h"
+
+// ms without a free slot in the transmit queue, or without a fragment done,
+// after which the picture fails.
+#ifndef CAMERA_STREAM_TIMEOUT
+#define CAMERA_STREAM_TIMEOUT   (5000)
+#endif /* CAMERA_STREAM_TIMEOUT */
+
+static size_t CameraStream_send(uint16_t panid, uint16_t dstAddr);
+static uint16_t CameraStream_getFailureCount();
+static uint8_t* CameraStream_reserve(size_t *capacity);
+static bool CameraStream_drain();
+static void CameraStream_callback(const Packet * const packet, uint8_t rssi, uint8_t status);
+
+static volatile size_t __acked;
+static volatile uint16_t __failures;
+
+const CameraStreamer CameraStream = {
+    CameraStream_send,
+    CameraStream_getFailureCount
+};
+
+// The camera writes each chunk straight into the transmit queue of the
+// radio. While the driver sends the queued fragments, the next chunk is read
+// from the UART, so the image takes about max(UART time, radio time).
+// A chunk which the camera or the radio does not take counts as a failure
+// and ends the picture.
+static size_t CameraStream_send(uint16_t panid, uint16_t dstAddr)
+{
+    __acked = 0;
+    __failures = 0;
+
+    do {
+        size_t capacity;
+        size_t size;
+        uint8_t *data;
+
+        data = CameraStream_reserve(&capacity);
+        if (data == NULL) {
+            DEBUG_PRINT("The transmit queue is stuck.");
+            Wireless.cancelDataAsync();
+            __failures++;
+            break;
+        }
+
+        // The Reassembler takes every fragment but the last at its full
+        // capacity, so the chunk fills the entry.
+        size = Camera.readData(data, capacity);
+        DEBUG_PRINT_LONG((long)size, DEC);
+        if ((size == 0) || ((size < capacity) && !Camera.isEOF())) {
+            DEBUG_PRINT("Reading the picture failed.");
+            Wireless.cancelDataAsync();
+            __failures++;
+            break;
+        }
+        if (Wireless.commitDataAsync(panid, dstAddr, size, Camera.isEOF(), CameraStream_callback) != 0) {
+            assert(false);
+            Wireless.cancelDataAsync();
+            __failures++;
+            break;
+        }
+    } while (!Camera.isEOF());
+
+    if (!CameraStream_drain()) {
+        DEBUG_PRINT("The transmit queue is stuck.");
+    }
+
+    return __acked;
+}
+
+// Waits for a free slot in the transmit queue, sleeping while the driver
+// sends.
+static uint8_t* CameraStream_reserve(size_t *capacity)
+{
+    uint32_t start = millis();
+    uint8_t *data;
+
+    while ((data = Wireless.reserveDataAsync(true, capacity)) == NULL) {
+        if ((millis() - start) > CAMERA_STREAM_TIMEOUT) {
+            return NULL;
+        }
+        sleep(1);
+    }
+
+    return data;
+}
+
+// Waits until the queued fragments are done. Returns false if none is done
+// for CAMERA_STREAM_TIMEOUT ms.
+static bool CameraStream_drain()
+{
+    uint32_t start = millis();
+    uint8_t length = Wireless.getTxQueueLength();
+
+    while (length != 0) {
+        uint8_t current;
+
+        sleep(1);
+        current = Wireless.getTxQueueLength();
+        if (current != length) {
+            length = current;
+            start = millis();
+        } else if ((millis() - start) > CAMERA_STREAM_TIMEOUT) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint16_t CameraStream_getFailureCount()
+{
+    return __failures;
+}
+
+static void CameraStream_callback(const Packet * const packet, uint8_t rssi, uint8_t status)
+{
+    (void)rssi;
+
+    if (status == SUBGHZ_OK) {
+        __acked += DATA_GET_DATA_SIZE(packet);
+    } else {
+        __failures++;
+    }
+}
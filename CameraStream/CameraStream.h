@@ -0,0 +1,15 @@
+#ifndef _CAMERA_STREAM_H_
+#define _CAMERA_STREAM_H_
+
+#include "lazurite.h"
+#include "Lazurite_Wireless.h"
+#include "LinkSpriteCamera.h"
+
+typedef struct {
+    size_t (*send)(uint16_t panid, uint16_t dstAddr);
+    uint16_t (*getFailureCount)();
+} CameraStreamer;
+
+extern const CameraStreamer CameraStream;
+
+#endif /* _CAMERA_STREAM_H_ */
@@ -0,0 +1,1171 @@
+#define _GNU_SOURCE
+#include "LazuriteSimulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+
+#ifndef SIMULATOR_STACK_SIZE
+#define SIMULATOR_STACK_SIZE        (256 * 1024)
+#endif /* SIMULATOR_STACK_SIZE */
+
+#ifndef SIMULATOR_EVENT_QUEUE_SIZE
+#define SIMULATOR_EVENT_QUEUE_SIZE  32
+#endif /* SIMULATOR_EVENT_QUEUE_SIZE */
+
+// Frames the driver holds until they are read by SubGHz.readData.
+#ifndef SIMULATOR_RX_BUFFER_SIZE
+#define SIMULATOR_RX_BUFFER_SIZE    2
+#endif /* SIMULATOR_RX_BUFFER_SIZE */
+
+#ifndef SIMULATOR_MAX_FRAMES
+#define SIMULATOR_MAX_FRAMES        64
+#endif /* SIMULATOR_MAX_FRAMES */
+
+// Defaults of SUBGHZ_PARAM
+#ifndef SIMULATOR_TX_RETRY
+#define SIMULATOR_TX_RETRY          3
+#endif /* SIMULATOR_TX_RETRY */
+
+#ifndef SIMULATOR_TX_INTERVAL
+#define SIMULATOR_TX_INTERVAL       500
+#endif /* SIMULATOR_TX_INTERVAL */
+
+#ifndef SIMULATOR_CCA_WAIT
+#define SIMULATOR_CCA_WAIT          7
+#endif /* SIMULATOR_CCA_WAIT */
+
+#define SIMULATOR_CCA_RETRY         4
+#define SIMULATOR_FRAME_SIZE        250
+#define SIMULATOR_MAC_OVERHEAD      11      // MHR 9, FCS 2
+#define SIMULATOR_PHY_OVERHEAD      8       // preamble 4, SFD 2, PHR 2
+#define SIMULATOR_ACK_SIZE          13      // PHY 8, frame control 2, sequence 1, FCS 2
+#define SIMULATOR_TURNAROUND        1000    // us
+
+typedef enum {
+    SIMULATOR_EVENT_RX,
+    SIMULATOR_EVENT_TX_DONE
+} SimEventType;
+
+typedef struct {
+    uint64_t _time;
+    uint64_t _start;
+    SimEventType _type;
+    uint8_t _rssi;
+    uint8_t _status;
+    void (*_callback)(uint8_t rssi, uint8_t status);
+    uint16_t _length;
+    uint8_t _data[SIMULATOR_FRAME_SIZE];
+} SimEvent;
+
+typedef struct {
+    bool _used;
+    uint8_t _src;
+    uint16_t _panid;
+    uint16_t _dstAddr;
+    uint64_t _start;
+    uint64_t _end;          // end of the frame
+    uint64_t _busy;         // end of the frame and its ACK
+    uint32_t _deaf;         // nodes which were transmitting during the frame
+    bool _ackExpected;
+    bool _collided;
+    bool _ackCollided;
+    void (*_callback)(uint8_t rssi, uint8_t status);
+    uint16_t _length;
+    uint8_t _data[SIMULATOR_FRAME_SIZE];
+} SimFrame;
+
+typedef struct {
+    uint8_t _lossPct;
+    uint8_t _rssi;
+    bool _set;
+} SimLink;
+
+typedef struct {
+    void *_handle;
+    void (*_setup)(void);
+    void (*_loop)(void);
+    const char *_argument;
+    uint16_t _address;
+    ucontext_t _context;
+    uint8_t *_stack;
+    uint64_t _time;
+    bool _alive;
+    uint8_t _irqMask;
+    bool _inInterrupt;
+    bool _began;
+    bool _rxEnabled;
+    uint16_t _panid;
+    SUBGHZ_RATE _rate;
+    bool _ackReq;
+    bool _broadcast;
+    bool _promiscuous;
+    SUBGHZ_PARAM _param;
+    void (*_rxCallback)(const uint8_t *data, uint8_t rssi, int status);
+    uint64_t _txUntil;
+    SUBGHZ_MSG _txResult;
+    uint8_t _txRssi;
+    SimEvent _events[SIMULATOR_EVENT_QUEUE_SIZE];
+    uint8_t _eventCount;
+    SimEvent _rxBuffer[SIMULATOR_RX_BUFFER_SIZE];
+    uint8_t _rxHead;
+    uint8_t _rxCount;
+    void (*_timerCallback)(void);
+    uint64_t _timerPeriod;
+    uint64_t _timerNext;
+    bool _timerRunning;
+    SimulatorStats _stats;
+} SimNode;
+
+static void Simulator_configure(const SimulatorConfig *config);
+static int Simulator_addNode(const char *sketch, uint16_t address, const char *argument);
+static void Simulator_setLink(uint8_t from, uint8_t to, uint8_t lossPct, uint8_t rssi);
+static uint64_t Simulator_run();
+static uint8_t Simulator_getNodeCount();
+static void Simulator_getStats(uint8_t node, SimulatorStats *stats);
+static void Simulator_printReport();
+static void* Simulator_load(const char *sketch);
+static void Simulator_entry();
+static void Simulator_advance(uint32_t us);
+static void Simulator_wait(uint64_t time);
+static void Simulator_settle(uint64_t now);
+static void Simulator_finalize(SimFrame * const frame);
+static void Simulator_deliver(SimFrame * const frame, uint8_t to);
+static void Simulator_dispatch(SimNode * const node);
+static bool Simulator_post(SimNode * const node, const SimEvent * const event);
+static SimFrame* Simulator_transmit(SimNode * const node, uint16_t panid, uint16_t dstAddr, const uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status), SUBGHZ_MSG *ret);
+static bool Simulator_isChannelBusy(uint8_t src, uint64_t now);
+static uint32_t Simulator_airtime(const SimNode * const node, uint16_t bytes);
+static uint8_t Simulator_getLinkLoss(uint8_t from, uint8_t to);
+static uint8_t Simulator_getLinkRssi(uint8_t from, uint8_t to);
+static uint32_t Simulator_random();
+static void Simulator_resetRadio(SimNode * const node);
+static void Simulator_assert(const char *kind, const char *assertion, const char *file, unsigned int line);
+
+static SUBGHZ_MSG SimRadio_init(void);
+static SUBGHZ_MSG SimRadio_remove(void);
+static SUBGHZ_MSG SimRadio_begin(uint8_t ch, uint16_t panid, SUBGHZ_RATE rate, SUBGHZ_POWER txPower);
+static SUBGHZ_MSG SimRadio_close(void);
+static SUBGHZ_MSG SimRadio_send(uint16_t panid, uint16_t dstAddr, uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status));
+static SUBGHZ_MSG SimRadio_rxEnable(void (*callback)(const uint8_t *data, uint8_t rssi, int status));
+static SUBGHZ_MSG SimRadio_rxDisable(void);
+static short SimRadio_readData(uint8_t *data, uint16_t max_size);
+static uint16_t SimRadio_getMyAddress(void);
+static void SimRadio_getStatus(SUBGHZ_STATUS *tx, SUBGHZ_STATUS *rx);
+static void SimRadio_msgOut(SUBGHZ_MSG msg);
+static SUBGHZ_MSG SimRadio_setSendMode(SUBGHZ_PARAM *param);
+static SUBGHZ_MSG SimRadio_getSendMode(SUBGHZ_PARAM *param);
+static SUBGHZ_MSG SimRadio_setAckReq(bool on);
+static SUBGHZ_MSG SimRadio_setBroadcastEnb(bool on);
+static SUBGHZ_MSG SimRadio_setPromiscuous(bool on);
+
+static void SimSerial_begin(uint32_t baud);
+static void SimSerial_end(void);
+static int SimSerial_available(void);
+static int SimSerial_read(void);
+static void SimSerial_flush(void);
+static size_t SimSerial_print(const char *str);
+static size_t SimSerial_println(const char *str);
+static size_t SimSerial_print_long(long data, uint8_t format);
+static size_t SimSerial_println_long(long data, uint8_t format);
+static size_t SimSerial_write(const uint8_t *data, size_t quantity);
+static size_t SimSerial_write_byte(uint8_t data);
+static int SimSerial_tx_available(void);
+static size_t SimUart_print(const char *str);
+static size_t SimUart_print_long(long data, uint8_t format);
+static size_t SimUart_write(const uint8_t *data, size_t quantity);
+static size_t SimUart_write_byte(uint8_t data);
+static void SimTimer_set(uint32_t ms, void (*callback)(void));
+static void SimTimer_start(void);
+static void SimTimer_stop(void);
+
+const LazuriteSimulator Simulator = {
+    Simulator_configure,
+    Simulator_addNode,
+    Simulator_setLink,
+    Simulator_run,
+    Simulator_getNodeCount,
+    Simulator_getStats,
+    Simulator_printReport
+};
+
+const SubGHz_CTRL SubGHz = {
+    SimRadio_init,
+    SimRadio_remove,
+    SimRadio_begin,
+    SimRadio_close,
+    SimRadio_send,
+    SimRadio_rxEnable,
+    SimRadio_rxDisable,
+    SimRadio_readData,
+    SimRadio_getMyAddress,
+    SimRadio_getStatus,
+    SimRadio_msgOut,
+    SimRadio_setSendMode,
+    SimRadio_getSendMode,
+    SimRadio_setAckReq,
+    SimRadio_setBroadcastEnb,
+    SimRadio_setPromiscuous
+};
+
+const HardwareSerial Serial = {
+    SimSerial_begin,
+    SimSerial_end,
+    SimSerial_available,
+    SimSerial_read,
+    SimSerial_read,
+    SimSerial_flush,
+    SimSerial_print,
+    SimSerial_println,
+    SimSerial_print_long,
+    SimSerial_println_long,
+    SimSerial_write,
+    SimSerial_write_byte,
+    SimSerial_tx_available
+};
+
+// Nothing is attached to the other UARTs. Reads find no data and writes
+// are dropped.
+#define SIM_UART { \
+    SimSerial_begin, SimSerial_end, SimSerial_available, SimSerial_read, SimSerial_read, SimSerial_flush, \
+    SimUart_print, SimUart_print, SimUart_print_long, SimUart_print_long, SimUart_write, SimUart_write_byte, \
+    SimSerial_tx_available }
+
+const HardwareSerial Serial1 = SIM_UART;
+const HardwareSerial Serial2 = SIM_UART;
+const HardwareSerial Serial3 = SIM_UART;
+
+const TIMER2 timer2 = {
+    SimTimer_set,
+    SimTimer_start,
+    SimTimer_stop
+};
+
+static SimulatorConfig __config = { 1, 0, 0, 0, 100, 0, 0, true, 128, 10, false };
+static SimNode __nodes[SIMULATOR_MAX_NODES];
+static uint8_t __nodeCount = 0;
+static SimLink __links[SIMULATOR_MAX_NODES][SIMULATOR_MAX_NODES];
+static SimFrame __frames[SIMULATOR_MAX_FRAMES];
+static SimNode *__current = NULL;
+static ucontext_t __scheduler;
+static uint64_t __now = 0;
+static uint32_t __random = 1;
+
+static void Simulator_configure(const SimulatorConfig *config)
+{
+    __config = *config;
+    if (__config.pollCost == 0) {
+        // A busy loop on millis() has to move the clock.
+        __config.pollCost = 1;
+    }
+    __random = (config->seed != 0) ? config->seed : 1;
+}
+
+static int Simulator_addNode(const char *sketch, uint16_t address, const char *argument)
+{
+    SimNode *node;
+    void *handle;
+
+    if (__nodeCount >= SIMULATOR_MAX_NODES) {
+        fprintf(stderr, "Too many nodes.\n");
+        return -1;
+    }
+
+    handle = Simulator_load(sketch);
+    if (handle == NULL) {
+        return -1;
+    }
+
+    node = &__nodes[__nodeCount];
+    memset(node, 0, sizeof(SimNode));
+    node->_handle = handle;
+    node->_setup = (void (*)(void))dlsym(handle, "setup");
+    node->_loop = (void (*)(void))dlsym(handle, "loop");
+    if ((node->_setup == NULL) || (node->_loop == NULL)) {
+        fprintf(stderr, "%s has no setup() or loop().\n", sketch);
+        dlclose(handle);
+        return -1;
+    }
+    node->_argument = (argument != NULL) ? argument : "";
+    node->_address = address;
+    Simulator_resetRadio(node);
+    node->_stats.address = address;
+    node->_stats.latencyMin = UINT32_MAX;
+
+    return __nodeCount++;
+}
+
+static void Simulator_setLink(uint8_t from, uint8_t to, uint8_t lossPct, uint8_t rssi)
+{
+    assert(from < SIMULATOR_MAX_NODES);
+    assert(to < SIMULATOR_MAX_NODES);
+
+    __links[from][to]._lossPct = lossPct;
+    __links[from][to]._rssi = rssi;
+    __links[from][to]._set = true;
+}
+
+static uint64_t Simulator_run()
+{
+    uint8_t i;
+
+    for (i = 0; i < __nodeCount; i++) {
+        SimNode *node = &__nodes[i];
+        node->_stack = malloc(SIMULATOR_STACK_SIZE);
+        getcontext(&node->_context);
+        node->_context.uc_stack.ss_sp = node->_stack;
+        node->_context.uc_stack.ss_size = SIMULATOR_STACK_SIZE;
+        node->_context.uc_link = &__scheduler;
+        makecontext(&node->_context, Simulator_entry, 0);
+        node->_alive = true;
+    }
+
+    // The node behind in virtual time runs next, so frames are put on air in
+    // the order of their start time.
+    for (;;) {
+        SimNode *next = NULL;
+
+        for (i = 0; i < __nodeCount; i++) {
+            if (__nodes[i]._alive && ((next == NULL) || (__nodes[i]._time < next->_time))) {
+                next = &__nodes[i];
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if ((__config.duration != 0) && (next->_time >= (uint64_t)__config.duration * 1000)) {
+            __now = (uint64_t)__config.duration * 1000;
+            break;
+        }
+
+        __now = next->_time;
+        Simulator_settle(__now);
+        __current = next;
+        swapcontext(&__scheduler, &next->_context);
+    }
+    __current = NULL;
+
+    for (i = 0; i < __nodeCount; i++) {
+        free(__nodes[i]._stack);
+        __nodes[i]._stack = NULL;
+    }
+
+    return __now;
+}
+
+static uint8_t Simulator_getNodeCount()
+{
+    return __nodeCount;
+}
+
+static void Simulator_getStats(uint8_t node, SimulatorStats *stats)
+{
+    assert(node < __nodeCount);
+
+    *stats = __nodes[node]._stats;
+    if (stats->rxFrames == 0) {
+        stats->latencyMin = 0;
+    }
+}
+
+static void Simulator_printReport()
+{
+    uint8_t i;
+
+    printf("%4s %6s %6s %6s %10s %6s %5s %5s %5s %6s %8s %5s %5s %8s %8s %10s\n",
+           "node", "addr", "tx", "tries", "airtime_ms", "duty%", "cca", "noack", "coll",
+           "rx", "rx_bytes", "lost", "ovf", "lat_avg", "lat_max", "goodput");
+    for (i = 0; i < __nodeCount; i++) {
+        SimulatorStats stats;
+        double duty;
+        double latency;
+        double goodput;
+
+        Simulator_getStats(i, &stats);
+        duty = (__now != 0) ? 100.0 * (double)stats.airtime / (double)__now : 0.0;
+        latency = (stats.rxFrames != 0) ? (double)stats.latencySum / stats.rxFrames / 1000.0 : 0.0;
+        goodput = (__now != 0) ? (double)stats.goodput * 8.0 * 1000000.0 / (double)__now : 0.0;
+        printf("%4u 0x%04x %6u %6u %10.1f %6.2f %5u %5u %5u %6u %8u %5u %5u %8.2f %8.2f %10.0f\n",
+               i, stats.address, stats.txFrames, stats.txAttempts, stats.airtime / 1000.0, duty,
+               stats.txCcaFailures, stats.txAckFailures, stats.collisions,
+               stats.rxFrames, stats.rxBytes, stats.rxLost, stats.rxOverflows,
+               latency, stats.latencyMax / 1000.0, goodput);
+    }
+    printf("elapsed %.3f s, latency in ms, goodput in bit/s\n", __now / 1000000.0);
+}
+
+// Every node gets its own copy of the sketch, so that the static state of
+// the libraries linked into it is not shared.
+static void* Simulator_load(const char *sketch)
+{
+    char path[] = "/tmp/lazurite-sim-XXXXXX";
+    uint8_t buffer[4096];
+    void *handle;
+    FILE *in;
+    FILE *out;
+    size_t size;
+    int fd;
+
+    in = fopen(sketch, "rb");
+    if (in == NULL) {
+        perror(sketch);
+        return NULL;
+    }
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        fclose(in);
+        return NULL;
+    }
+    out = fdopen(fd, "wb");
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, size, out);
+    }
+    fclose(in);
+    fclose(out);
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    remove(path);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+    }
+
+    return handle;
+}
+
+static void Simulator_entry()
+{
+    SimNode *node = __current;
+
+    node->_setup();
+    while (node->_alive) {
+        node->_loop();
+        Simulator_advance(__config.pollCost);
+    }
+}
+
+// Gives the other nodes the chance to catch up, and takes the interrupts
+// which became due in the meantime.
+static void Simulator_advance(uint32_t us)
+{
+    SimNode *node = __current;
+
+    node->_time += us;
+    swapcontext(&node->_context, &__scheduler);
+    Simulator_dispatch(node);
+}
+
+static void Simulator_wait(uint64_t time)
+{
+    SimNode *node = __current;
+
+    Simulator_advance((time > node->_time) ? (uint32_t)(time - node->_time) : 0);
+}
+
+// Every frame which has ended by now can be resolved, because no other frame
+// can start before now any more.
+static void Simulator_settle(uint64_t now)
+{
+    uint8_t i;
+
+    for (i = 0; i < SIMULATOR_MAX_FRAMES; i++) {
+        if (__frames[i]._used && (__frames[i]._busy <= now)) {
+            Simulator_finalize(&__frames[i]);
+            __frames[i]._used = false;
+        }
+    }
+}
+
+static void Simulator_finalize(SimFrame * const frame)
+{
+    SimNode *sender = &__nodes[frame->_src];
+    bool acked = false;
+    uint8_t i;
+
+    if (frame->_collided) {
+        sender->_stats.collisions++;
+    }
+
+    for (i = 0; i < __nodeCount; i++) {
+        SimNode *node = &__nodes[i];
+        bool addressed;
+
+        if ((i == frame->_src) || !node->_alive || !node->_began || !node->_rxEnabled) {
+            continue;
+        }
+        if (node->_panid != frame->_panid) {
+            continue;
+        }
+        addressed = (frame->_dstAddr == node->_address) ||
+                    ((frame->_dstAddr == SIMULATOR_BROADCAST) && node->_broadcast);
+        if (!addressed && !node->_promiscuous) {
+            continue;
+        }
+        if (frame->_collided || (frame->_deaf & (1UL << i)) ||
+            ((Simulator_random() % 100) < Simulator_getLinkLoss(frame->_src, i))) {
+            node->_stats.rxLost++;
+            continue;
+        }
+
+        Simulator_deliver(frame, i);
+
+        if (frame->_ackExpected && (frame->_dstAddr == node->_address)) {
+            node->_stats.airtime += Simulator_airtime(sender, SIMULATOR_ACK_SIZE - SIMULATOR_PHY_OVERHEAD);
+            if (!frame->_ackCollided &&
+                ((Simulator_random() % 100) >= Simulator_getLinkLoss(i, frame->_src))) {
+                acked = true;
+                sender->_txRssi = Simulator_getLinkRssi(i, frame->_src);
+            }
+        }
+    }
+
+    sender->_txResult = (!frame->_ackExpected || acked) ? SUBGHZ_OK : SUBGHZ_TX_ACK_FAIL;
+    if (sender->_txResult == SUBGHZ_OK) {
+        sender->_stats.txFrames++;
+        sender->_stats.txBytes += frame->_length;
+    } else {
+        sender->_stats.txAckFailures++;
+    }
+
+    if (frame->_callback != NULL) {
+        SimEvent event;
+
+        event._time = frame->_busy;
+        event._start = frame->_start;
+        event._type = SIMULATOR_EVENT_TX_DONE;
+        event._rssi = frame->_ackExpected ? sender->_txRssi : 0;
+        event._status = (uint8_t)sender->_txResult;
+        event._callback = frame->_callback;
+        event._length = 0;
+        Simulator_post(sender, &event);
+    }
+}
+
+static void Simulator_deliver(SimFrame * const frame, uint8_t to)
+{
+    SimEvent event;
+
+    event._time = frame->_end + __config.latency;
+    if (__config.jitter != 0) {
+        event._time += Simulator_random() % (__config.jitter + 1);
+    }
+    event._start = frame->_start;
+    event._type = SIMULATOR_EVENT_RX;
+    event._rssi = Simulator_getLinkRssi(frame->_src, to);
+    event._status = 0;
+    event._callback = NULL;
+    event._length = frame->_length;
+    memcpy(event._data, frame->_data, frame->_length);
+
+    if (!Simulator_post(&__nodes[to], &event)) {
+        __nodes[to]._stats.rxOverflows++;
+    }
+}
+
+static void Simulator_dispatch(SimNode * const node)
+{
+    if (node->_inInterrupt) {
+        return;
+    }
+
+    // The interrupts which are due run in the order of their time, one at a
+    // time: a handler is not interrupted.
+    for (;;) {
+        bool radio = (node->_eventCount > 0) && (node->_events[0]._time <= node->_time) &&
+                     !(node->_irqMask & DI_SUBGHZ);
+        bool timer = node->_timerRunning && (node->_timerNext <= node->_time) && !(node->_irqMask & DI_TIMER);
+        SimEvent event;
+
+        if (timer && (!radio || (node->_timerNext <= node->_events[0]._time))) {
+            node->_timerNext += node->_timerPeriod;
+            node->_inInterrupt = true;
+            node->_timerCallback();
+            node->_inInterrupt = false;
+            continue;
+        }
+        if (!radio) {
+            return;
+        }
+
+        event = node->_events[0];
+        node->_eventCount--;
+        memmove(&node->_events[0], &node->_events[1], node->_eventCount * sizeof(SimEvent));
+
+        if (event._type == SIMULATOR_EVENT_TX_DONE) {
+            node->_inInterrupt = true;
+            event._callback(event._rssi, event._status);
+            node->_inInterrupt = false;
+            continue;
+        }
+
+        if (!node->_rxEnabled) {
+            continue;
+        }
+        if (node->_rxCount >= SIMULATOR_RX_BUFFER_SIZE) {
+            node->_stats.rxOverflows++;
+            continue;
+        }
+        node->_rxBuffer[(node->_rxHead + node->_rxCount) % SIMULATOR_RX_BUFFER_SIZE] = event;
+        node->_rxCount++;
+        if (node->_rxCallback != NULL) {
+            node->_inInterrupt = true;
+            node->_rxCallback(event._data, event._rssi, event._length);
+            node->_inInterrupt = false;
+        }
+    }
+}
+
+static bool Simulator_post(SimNode * const node, const SimEvent * const event)
+{
+    uint8_t i;
+
+    if (node->_eventCount >= SIMULATOR_EVENT_QUEUE_SIZE) {
+        return false;
+    }
+
+    for (i = node->_eventCount; (i > 0) && (node->_events[i - 1]._time > event->_time); i--) {
+        node->_events[i] = node->_events[i - 1];
+    }
+    node->_events[i] = *event;
+    node->_eventCount++;
+
+    return true;
+}
+
+static SimFrame* Simulator_transmit(SimNode * const node, uint16_t panid, uint16_t dstAddr, const uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status), SUBGHZ_MSG *ret)
+{
+    SimFrame *frame = NULL;
+    uint8_t src = (uint8_t)(node - __nodes);
+    uint8_t cca;
+    uint8_t i;
+
+    for (cca = 0; ; cca++) {
+        // Let every node which is behind put its frames on air first.
+        Simulator_advance(0);
+        if (!Simulator_isChannelBusy(src, node->_time)) {
+            break;
+        }
+        if (cca >= SIMULATOR_CCA_RETRY) {
+            node->_stats.txCcaFailures++;
+            *ret = SUBGHZ_TX_CCA_FAIL;
+            return NULL;
+        }
+        Simulator_advance(Simulator_random() % ((uint32_t)node->_param.ccaWait * 1000 + 1));
+    }
+
+    for (i = 0; i < SIMULATOR_MAX_FRAMES; i++) {
+        if (!__frames[i]._used) {
+            frame = &__frames[i];
+            break;
+        }
+    }
+    if (frame == NULL) {
+        *ret = SUBGHZ_TX_FAIL;
+        return NULL;
+    }
+
+    memset(frame, 0, sizeof(SimFrame));
+    frame->_used = true;
+    frame->_src = src;
+    frame->_panid = panid;
+    frame->_dstAddr = dstAddr;
+    frame->_start = node->_time;
+    frame->_end = frame->_start + Simulator_airtime(node, len + SIMULATOR_MAC_OVERHEAD);
+    frame->_ackExpected = node->_ackReq && (dstAddr != SIMULATOR_BROADCAST);
+    frame->_busy = frame->_end;
+    if (frame->_ackExpected) {
+        frame->_busy += SIMULATOR_TURNAROUND + Simulator_airtime(node, SIMULATOR_ACK_SIZE - SIMULATOR_PHY_OVERHEAD);
+    }
+    frame->_callback = callback;
+    frame->_length = len;
+    memcpy(frame->_data, data, len);
+
+    // Frames on air which CCA did not see collide with the new one, and
+    // their senders cannot hear each other.
+    for (i = 0; i < SIMULATOR_MAX_FRAMES; i++) {
+        SimFrame *other = &__frames[i];
+
+        if (!other->_used || (other == frame) || (other->_busy <= frame->_start)) {
+            continue;
+        }
+        if (other->_src == src) {
+            continue;
+        }
+        other->_deaf |= 1UL << src;
+        frame->_deaf |= 1UL << other->_src;
+        if (!__config.collisions) {
+            continue;
+        }
+        frame->_collided = true;
+        if (other->_end > frame->_start) {
+            other->_collided = true;
+        } else {
+            other->_ackCollided = true;
+        }
+    }
+
+    node->_txUntil = frame->_busy;
+    node->_stats.txAttempts++;
+    node->_stats.airtime += frame->_end - frame->_start;
+    *ret = SUBGHZ_OK;
+
+    return frame;
+}
+
+static bool Simulator_isChannelBusy(uint8_t src, uint64_t now)
+{
+    uint8_t i;
+
+    for (i = 0; i < SIMULATOR_MAX_FRAMES; i++) {
+        const SimFrame *frame = &__frames[i];
+
+        if (frame->_used && (frame->_src != src) &&
+            (frame->_start + __config.ccaWindow <= now) && (now < frame->_busy)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t Simulator_airtime(const SimNode * const node, uint16_t bytes)
+{
+    uint32_t rate = (__config.rate != 0) ? (uint32_t)__config.rate : (uint32_t)node->_rate;
+
+    // kbps is bits per ms
+    return (uint32_t)(bytes + SIMULATOR_PHY_OVERHEAD) * 8 * 1000 / rate;
+}
+
+static uint8_t Simulator_getLinkLoss(uint8_t from, uint8_t to)
+{
+    return __links[from][to]._set ? __links[from][to]._lossPct : __config.lossPct;
+}
+
+static uint8_t Simulator_getLinkRssi(uint8_t from, uint8_t to)
+{
+    return __links[from][to]._set ? __links[from][to]._rssi : __config.rssi;
+}
+
+// xorshift32, so that runs with the same seed are identical on every host
+static uint32_t Simulator_random()
+{
+    uint32_t x = __random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    __random = x;
+
+    return x;
+}
+
+static void Simulator_resetRadio(SimNode * const node)
+{
+    node->_began = false;
+    node->_rxEnabled = false;
+    node->_rxCallback = NULL;
+    node->_rate = SUBGHZ_100KBPS;
+    node->_ackReq = true;
+    node->_broadcast = true;
+    node->_promiscuous = false;
+    node->_param.addrType = 6;
+    node->_param.senseTime = 20;
+    node->_param.txRetry = SIMULATOR_TX_RETRY;
+    node->_param.txInterval = SIMULATOR_TX_INTERVAL;
+    node->_param.ccaWait = SIMULATOR_CCA_WAIT;
+    node->_rxHead = 0;
+    node->_rxCount = 0;
+}
+
+uint8_t SimNode_getId()
+{
+    return (uint8_t)(__current - __nodes);
+}
+
+const char* SimNode_getArgument()
+{
+    return __current->_argument;
+}
+
+void SimNode_addGoodput(size_t bytes)
+{
+    __current->_stats.goodput += (uint32_t)bytes;
+}
+
+void SimNode_exit()
+{
+    __current->_alive = false;
+    swapcontext(&__current->_context, &__scheduler);
+}
+
+static SUBGHZ_MSG SimRadio_init(void)
+{
+    Simulator_resetRadio(__current);
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_remove(void)
+{
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_begin(uint8_t ch, uint16_t panid, SUBGHZ_RATE rate, SUBGHZ_POWER txPower)
+{
+    // Every node shares one channel, and the power does not change the
+    // model of the link.
+    (void)ch;
+    (void)txPower;
+
+    if ((rate != SUBGHZ_50KBPS) && (rate != SUBGHZ_100KBPS)) {
+        return SUBGHZ_SETUP_FAIL;
+    }
+
+    __current->_panid = panid;
+    __current->_rate = rate;
+    __current->_began = true;
+
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_close(void)
+{
+    __current->_began = false;
+    __current->_rxEnabled = false;
+
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_send(uint16_t panid, uint16_t dstAddr, uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status))
+{
+    SimNode *node = __current;
+    SimFrame *frame;
+    SUBGHZ_MSG ret = SUBGHZ_TX_FAIL;
+    uint8_t attempt;
+
+    if (!node->_began || (len > SIMULATOR_FRAME_SIZE - SIMULATOR_MAC_OVERHEAD) || (node->_txUntil > node->_time)) {
+        return SUBGHZ_TX_FAIL;
+    }
+
+    // Asynchronous sends are not retried, the callback gets the result of
+    // the first attempt.
+    if (callback != NULL) {
+        Simulator_transmit(node, panid, dstAddr, data, len, callback, &ret);
+        return ret;
+    }
+
+    for (attempt = 0; attempt <= node->_param.txRetry; attempt++) {
+        frame = Simulator_transmit(node, panid, dstAddr, data, len, NULL, &ret);
+        if (frame == NULL) {
+            return ret;
+        }
+        Simulator_wait(frame->_busy);
+        if (node->_txResult == SUBGHZ_OK) {
+            return SUBGHZ_OK;
+        }
+        if (attempt < node->_param.txRetry) {
+            Simulator_advance((uint32_t)node->_param.txInterval * 1000);
+        }
+    }
+
+    return SUBGHZ_TX_ACK_FAIL;
+}
+
+static SUBGHZ_MSG SimRadio_rxEnable(void (*callback)(const uint8_t *data, uint8_t rssi, int status))
+{
+    __current->_rxEnabled = true;
+    __current->_rxCallback = callback;
+
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_rxDisable(void)
+{
+    __current->_rxEnabled = false;
+    __current->_rxCallback = NULL;
+
+    return SUBGHZ_OK;
+}
+
+static short SimRadio_readData(uint8_t *data, uint16_t max_size)
+{
+    SimNode *node = __current;
+    SimEvent *event;
+    uint32_t latency;
+    uint16_t length;
+
+    if (!node->_inInterrupt) {
+        Simulator_advance(__config.pollCost);
+    }
+    if (node->_rxCount == 0) {
+        return 0;
+    }
+
+    event = &node->_rxBuffer[node->_rxHead];
+    length = (event->_length < max_size) ? event->_length : max_size;
+    memcpy(data, event->_data, length);
+    node->_rxHead = (node->_rxHead + 1) % SIMULATOR_RX_BUFFER_SIZE;
+    node->_rxCount--;
+
+    latency = (uint32_t)(node->_time - event->_start);
+    node->_stats.rxFrames++;
+    node->_stats.rxBytes += length;
+    node->_stats.latencySum += latency;
+    if (latency < node->_stats.latencyMin) {
+        node->_stats.latencyMin = latency;
+    }
+    if (latency > node->_stats.latencyMax) {
+        node->_stats.latencyMax = latency;
+    }
+
+    return (short)length;
+}
+
+static uint16_t SimRadio_getMyAddress(void)
+{
+    return __current->_address;
+}
+
+static void SimRadio_getStatus(SUBGHZ_STATUS *tx, SUBGHZ_STATUS *rx)
+{
+    if (tx != NULL) {
+        tx->rssi = __current->_txRssi;
+        tx->status = (uint16_t)__current->_txResult;
+    }
+    if (rx != NULL) {
+        rx->rssi = 0;
+        rx->status = 0;
+    }
+}
+
+static void SimRadio_msgOut(SUBGHZ_MSG msg)
+{
+    if (__config.verbose) {
+        printf("[%u] SUBGHZ_MSG %d\n", SimNode_getId(), (int)msg);
+    }
+}
+
+static SUBGHZ_MSG SimRadio_setSendMode(SUBGHZ_PARAM *param)
+{
+    __current->_param = *param;
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_getSendMode(SUBGHZ_PARAM *param)
+{
+    *param = __current->_param;
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_setAckReq(bool on)
+{
+    __current->_ackReq = on;
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_setBroadcastEnb(bool on)
+{
+    __current->_broadcast = on;
+    return SUBGHZ_OK;
+}
+
+static SUBGHZ_MSG SimRadio_setPromiscuous(bool on)
+{
+    __current->_promiscuous = on;
+    return SUBGHZ_OK;
+}
+
+static void SimSerial_begin(uint32_t baud)
+{
+    (void)baud;
+}
+
+static void SimSerial_end(void)
+{
+}
+
+static int SimSerial_available(void)
+{
+    return 0;
+}
+
+static int SimSerial_read(void)
+{
+    return -1;
+}
+
+static void SimSerial_flush(void)
+{
+    if (__config.verbose) {
+        fflush(stdout);
+    }
+}
+
+static size_t SimSerial_print(const char *str)
+{
+    return __config.verbose ? (size_t)printf("%s", str) : strlen(str);
+}
+
+static size_t SimSerial_println(const char *str)
+{
+    return __config.verbose ? (size_t)printf("%s\n", str) : strlen(str) + 1;
+}
+
+static size_t SimSerial_print_long(long data, uint8_t format)
+{
+    if (!__config.verbose) {
+        return 0;
+    }
+    return (size_t)printf((format == HEX) ? "%lx" : "%ld", data);
+}
+
+static size_t SimSerial_println_long(long data, uint8_t format)
+{
+    size_t size = SimSerial_print_long(data, format);
+    return size + SimSerial_println("");
+}
+
+static size_t SimSerial_write(const uint8_t *data, size_t quantity)
+{
+    if (__config.verbose) {
+        fwrite(data, 1, quantity, stdout);
+    }
+    return quantity;
+}
+
+static size_t SimSerial_write_byte(uint8_t data)
+{
+    return SimSerial_write(&data, 1);
+}
+
+static int SimSerial_tx_available(void)
+{
+    return 64;
+}
+
+static size_t SimUart_print(const char *str)
+{
+    return strlen(str);
+}
+
+static size_t SimUart_print_long(long data, uint8_t format)
+{
+    (void)data;
+    (void)format;
+
+    return 0;
+}
+
+static size_t SimUart_write(const uint8_t *data, size_t quantity)
+{
+    (void)data;
+
+    return quantity;
+}
+
+static size_t SimUart_write_byte(uint8_t data)
+{
+    (void)data;
+
+    return 1;
+}
+
+static void SimTimer_set(uint32_t ms, void (*callback)(void))
+{
+    __current->_timerPeriod = (uint64_t)ms * 1000;
+    __current->_timerCallback = callback;
+}
+
+static void SimTimer_start(void)
+{
+    if ((__current->_timerCallback == NULL) || (__current->_timerPeriod == 0)) {
+        return;
+    }
+    __current->_timerNext = __current->_time + __current->_timerPeriod;
+    __current->_timerRunning = true;
+}
+
+static void SimTimer_stop(void)
+{
+    __current->_timerRunning = false;
+}
+
+uint32_t millis(void)
+{
+    Simulator_advance(__config.pollCost);
+    return (uint32_t)(__current->_time / 1000);
+}
+
+uint32_t micros(void)
+{
+    Simulator_advance(__config.pollCost);
+    return (uint32_t)__current->_time;
+}
+
+void delay(uint32_t ms)
+{
+    Simulator_advance(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    Simulator_advance(us);
+}
+
+void sleep(uint32_t ms)
+{
+    Simulator_advance(ms * 1000);
+}
+
+void dis_interrupts(uint8_t irq)
+{
+    __current->_irqMask |= irq;
+}
+
+// Takes 1 us, so that a loop which waits for an interrupt between
+// dis_interrupts and enb_interrupts gets it.
+void enb_interrupts(uint8_t irq)
+{
+    __current->_irqMask &= (uint8_t)~irq;
+    Simulator_advance(1);
+}
+
+void wait_event(bool *flag)
+{
+    while (!*flag) {
+        Simulator_advance(__config.pollCost);
+    }
+    *flag = false;
+}
+
+void wait_event_timeout(bool *flag, uint32_t ms)
+{
+    uint64_t end = __current->_time + (uint64_t)ms * 1000;
+
+    while (!*flag && (__current->_time < end)) {
+        Simulator_advance(__config.pollCost);
+    }
+    *flag = false;
+}
+
+static void Simulator_assert(const char *kind, const char *assertion, const char *file, unsigned int line)
+{
+    fprintf(stderr, "[%u] %s: %s at %s::%u\n", SimNode_getId(), kind, assertion, file, line);
+}
+
+void __assert_brk(const char *assertion, const char *file, unsigned int line)
+{
+    Simulator_assert("brk", assertion, file, line);
+}
+
+void __assert_dhalt(const char *assertion, const char *file, unsigned int line)
+{
+    Simulator_assert("halt", assertion, file, line);
+    exit(EXIT_FAILURE);
+}
+
+void __assert_stop(const char *assertion, const char *file, unsigned int line)
+{
+    Simulator_assert("stop", assertion, file, line);
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,60 @@
+#ifndef _LAZURITE_SIMULATOR_H_
+#define _LAZURITE_SIMULATOR_H_
+
+#include "lazurite.h"
+
+#define SIMULATOR_MAX_NODES     32
+#define SIMULATOR_BROADCAST     0xffff
+
+typedef struct {
+    uint32_t seed;
+    uint32_t duration;      // ms of virtual time, 0 runs until every node has exited
+    SUBGHZ_RATE rate;       // 0 uses the rate given to SubGHz.begin
+    uint8_t lossPct;        // chance for a frame to be lost on each link
+    uint8_t rssi;
+    uint32_t latency;       // us from the end of a frame until the receiver gets it
+    uint32_t jitter;        // us, added at random to the latency
+    bool collisions;
+    uint32_t ccaWindow;     // us before a frame on air can be sensed by CCA
+    uint32_t pollCost;      // us spent in each call to millis, micros or readData
+    bool verbose;           // print Serial output of the sketches
+} SimulatorConfig;
+
+typedef struct {
+    uint16_t address;
+    uint32_t txFrames;
+    uint32_t txBytes;
+    uint32_t txAttempts;
+    uint32_t txCcaFailures;
+    uint32_t txAckFailures;
+    uint32_t collisions;
+    uint64_t airtime;       // us
+    uint32_t rxFrames;
+    uint32_t rxBytes;
+    uint32_t rxLost;
+    uint32_t rxOverflows;
+    uint64_t latencySum;    // us from the start of a frame until it is handed to the receiver
+    uint32_t latencyMin;
+    uint32_t latencyMax;
+    uint32_t goodput;       // bytes reported by the sketch through SimNode_addGoodput
+} SimulatorStats;
+
+typedef struct {
+    void (*configure)(const SimulatorConfig *config);
+    int (*addNode)(const char *sketch, uint16_t address, const char *argument);
+    void (*setLink)(uint8_t from, uint8_t to, uint8_t lossPct, uint8_t rssi);
+    uint64_t (*run)();
+    uint8_t (*getNodeCount)();
+    void (*getStats)(uint8_t node, SimulatorStats *stats);
+    void (*printReport)();
+} LazuriteSimulator;
+
+extern const LazuriteSimulator Simulator;
+
+// For sketches running on a virtual node
+extern uint8_t SimNode_getId();
+extern const char* SimNode_getArgument();
+extern void SimNode_addGoodput(size_t bytes);
+extern void SimNode_exit();
+
+#endif /* _LAZURITE_SIMULATOR_H_ */
@@ -0,0 +1,418 @@
+#include "LinkSpriteCamera.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// CPU cycles which the LinkSprite camera driver spends per picture. A model
+// of the camera answers on Serial3, one byte every 10 bit times of the
+// baud rate, into an RX buffer of RX_BUFFER_SIZE bytes. Time advances by
+// CALL_CYCLES in every call into the SDK, and by the time given to sleep()
+// and delay(). The CPU is busy except in sleep(). Results are printed as one
+// JSON object per line.
+//
+// The camera has a rate of its own, which command 0x24 changes once its
+// answer has been sent. Bytes are garbled while the UART runs at another
+// rate. Answers of the camera are also garbled above the rate which its TX
+// line carries.
+
+#define CPU_MHZ             16
+#define CALL_CYCLES         32
+#define RX_BUFFER_SIZE      64
+#define RESPONSE_DELAY      100         // us from a command until the answer
+#define IMAGE_SIZE          12000
+#define TX_BUFFER_SIZE      16
+#define READ_ALIGNMENT      8
+#define CHUNK_MAX_SIZE      4096
+
+static const uint32_t __bauds[] = { CAMERA_BAUD_38400, CAMERA_BAUD_115200 };
+static const size_t __chunkSizes[] = { 32, 232, 238, 4096 };
+
+static uint64_t __now;                  // in cycles
+static uint64_t __slept;
+static uint32_t __calls;
+static uint32_t __baud;
+static uint32_t __cameraBaud;
+static uint32_t __linkMaxBaud;
+
+static uint8_t __image[IMAGE_SIZE];
+static uint8_t __command[TX_BUFFER_SIZE];
+static size_t __commandLength;
+
+// The answer of the camera, and when its first byte arrives.
+static uint8_t __answer[16 + CHUNK_MAX_SIZE + READ_ALIGNMENT];
+static size_t __answerLength;
+static size_t __answerNext;
+static uint64_t __answerStart;
+static uint32_t __answerBaud;
+
+static uint8_t __rx[RX_BUFFER_SIZE];
+static size_t __rxHead;
+static size_t __rxCount;
+static uint32_t __rxOverflows;
+
+
+static void Benchmark_spend(uint64_t cycles)
+{
+    __now += cycles;
+    // Bytes arrive while the CPU works or sleeps.
+    while ((__answerNext < __answerLength) &&
+           (__answerStart + (uint64_t)__answerNext * 10 * (CPU_MHZ * 1000000 / __answerBaud) <= __now)) {
+        if (__rxCount < RX_BUFFER_SIZE) {
+            uint8_t data = __answer[__answerNext];
+
+            if ((__answerBaud != __baud) || (__answerBaud > __linkMaxBaud)) {
+                data ^= 0x55;
+            }
+            __rx[(__rxHead + __rxCount) % RX_BUFFER_SIZE] = data;
+            __rxCount++;
+        } else {
+            __rxOverflows++;
+        }
+        __answerNext++;
+    }
+}
+
+static void Benchmark_call()
+{
+    __calls++;
+    Benchmark_spend(CALL_CYCLES);
+}
+
+static unsigned int Benchmark_toBaud(uint32_t baud)
+{
+    switch (baud) {
+    case CAMERA_BAUD_9600:
+        return 9600;
+    case CAMERA_BAUD_19200:
+        return 19200;
+    case CAMERA_BAUD_57600:
+        return 57600;
+    case CAMERA_BAUD_115200:
+        return 115200;
+    default:
+        return 38400;
+    }
+}
+
+static void Camera_answer(const uint8_t *data, size_t length)
+{
+    if (__answerNext >= __answerLength) {
+        __answerLength = 0;
+        __answerNext = 0;
+        __answerStart = __now + (uint64_t)RESPONSE_DELAY * CPU_MHZ;
+        __answerBaud = __cameraBaud;
+    }
+    memcpy(&__answer[__answerLength], data, length);
+    __answerLength += length;
+}
+
+static void Camera_execute()
+{
+    static const uint8_t ok[] = { 0x76, 0x00, 0x00, 0x00, 0x00 };
+    static const char boot[] = "Ctrl infr exist\r\nInit end\r\n";
+    uint8_t header[9];
+
+    memcpy(header, ok, sizeof(ok));
+    header[2] = __command[2];
+
+    switch (__command[2]) {
+    case 0x26:
+        Camera_answer(header, 4);
+        Camera_answer((const uint8_t *)boot, sizeof(boot) - 1);
+        break;
+    case 0x24:
+        Camera_answer(header, sizeof(ok));
+        __cameraBaud = Benchmark_toBaud(((uint32_t)__command[5] << 8) | __command[6]);
+        break;
+    case 0x34:
+        header[4] = 0x04;
+        header[5] = 0x00;
+        header[6] = 0x00;
+        header[7] = (uint8_t)(IMAGE_SIZE >> 8);
+        header[8] = (uint8_t)(IMAGE_SIZE & 0xff);
+        Camera_answer(header, 9);
+        break;
+    case 0x32: {
+        size_t address = ((size_t)__command[6] << 24) | ((size_t)__command[7] << 16) | ((size_t)__command[8] << 8) | __command[9];
+        size_t length = ((size_t)__command[10] << 24) | ((size_t)__command[11] << 16) | ((size_t)__command[12] << 8) | __command[13];
+        size_t i;
+
+        // The camera reads aligned blocks only.
+        if ((address % READ_ALIGNMENT != 0) || (length % READ_ALIGNMENT != 0) || (length > CHUNK_MAX_SIZE + READ_ALIGNMENT)) {
+            header[3] = 0x03;
+            Camera_answer(header, sizeof(ok));
+            break;
+        }
+        Camera_answer(header, sizeof(ok));
+        // Past the end of the picture the camera sends padding.
+        for (i = 0; i < length; i++) {
+            uint8_t data = (address + i < IMAGE_SIZE) ? __image[address + i] : 0;
+            Camera_answer(&data, 1);
+        }
+        Camera_answer(header, sizeof(ok));
+        break;
+    }
+    default:
+        Camera_answer(header, sizeof(ok));
+        break;
+    }
+}
+
+static size_t Camera_commandLength()
+{
+    if (__commandLength < 4) {
+        return TX_BUFFER_SIZE;
+    }
+    return 4 + (size_t)__command[3];
+}
+
+static size_t CameraSerial_write_byte(uint8_t data)
+{
+    Benchmark_call();
+    if (__cameraBaud != __baud) {
+        __commandLength = 0;
+        return 1;
+    }
+    __command[__commandLength++] = data;
+    if (__commandLength == Camera_commandLength()) {
+        Camera_execute();
+        __commandLength = 0;
+    }
+    return 1;
+}
+
+static size_t CameraSerial_write(const uint8_t *data, size_t quantity)
+{
+    size_t i;
+
+    for (i = 0; i < quantity; i++) {
+        CameraSerial_write_byte(data[i]);
+    }
+    return quantity;
+}
+
+static int CameraSerial_available(void)
+{
+    Benchmark_call();
+    return (int)__rxCount;
+}
+
+static int CameraSerial_read(void)
+{
+    int data;
+
+    Benchmark_call();
+    if (__rxCount == 0) {
+        return -1;
+    }
+    data = __rx[__rxHead];
+    __rxHead = (__rxHead + 1) % RX_BUFFER_SIZE;
+    __rxCount--;
+    return data;
+}
+
+static void CameraSerial_begin(uint32_t baud)
+{
+    __baud = baud;
+}
+
+static void Serial_begin(uint32_t baud) { (void)baud; }
+static void Serial_none(void) {}
+static int Serial_int(void) { return -1; }
+static size_t Serial_print(const char *str) { (void)str; return 0; }
+static size_t Serial_print_long(long data, uint8_t format) { (void)data; (void)format; return 0; }
+static size_t Serial_write(const uint8_t *data, size_t quantity) { (void)data; return quantity; }
+static size_t Serial_write_byte(uint8_t data) { (void)data; return 1; }
+
+const HardwareSerial Serial = {
+    Serial_begin, Serial_none, Serial_int, Serial_int, Serial_int, Serial_none, Serial_print, Serial_print,
+    Serial_print_long, Serial_print_long, Serial_write, Serial_write_byte, Serial_int
+};
+
+const HardwareSerial Serial3 = {
+    CameraSerial_begin, Serial_none, CameraSerial_available, CameraSerial_read, CameraSerial_read, Serial_none,
+    Serial_print, Serial_print, Serial_print_long, Serial_print_long, CameraSerial_write, CameraSerial_write_byte,
+    Serial_int
+};
+
+uint32_t millis(void) { Benchmark_call(); return (uint32_t)(__now / CPU_MHZ / 1000); }
+uint32_t micros(void) { Benchmark_call(); return (uint32_t)(__now / CPU_MHZ); }
+void delay(uint32_t ms) { Benchmark_spend((uint64_t)ms * 1000 * CPU_MHZ); }
+void delayMicroseconds(uint32_t us) { Benchmark_spend((uint64_t)us * CPU_MHZ); }
+void __assert_brk(const char *assertion, const char *file, unsigned int line) { (void)assertion; (void)file; (void)line; }
+
+void sleep(uint32_t ms)
+{
+    uint64_t cycles = (uint64_t)ms * 1000 * CPU_MHZ;
+
+    __slept += cycles;
+    Benchmark_spend(cycles);
+}
+
+static void Benchmark_print(const char *name, uint32_t baud, size_t chunk, size_t received, uint64_t start,
+                            uint64_t slept, uint32_t calls, uint64_t longest)
+{
+    printf("{\"benchmark\":\"%s\",\"baud\":%u,\"chunk\":%u,\"image\":%u,\"received\":%u,\"calls\":%u,"
+           "\"overflows\":%u,\"elapsed_ms\":%.1f,\"longest_call_us\":%llu,\"value\":%llu,\"unit\":\"cycles\"}\n",
+           name, Benchmark_toBaud(baud), (unsigned int)chunk, IMAGE_SIZE, (unsigned int)received, __calls - calls,
+           __rxOverflows, (double)(__now - start) / CPU_MHZ / 1000, (unsigned long long)(longest / CPU_MHZ),
+           (unsigned long long)((__now - start) - (__slept - slept)));
+}
+
+// Keeps the longest time spent in one call to the driver, which is as long
+// as the main loop stalls.
+#define MEASURE(call) do { \
+        uint64_t before = __now; \
+        call; \
+        if (__now - before > longest) { \
+            longest = __now - before; \
+        } \
+    } while (0)
+
+static void Benchmark_blocking(uint32_t baud, size_t chunk)
+{
+    static uint8_t data[CHUNK_MAX_SIZE];
+    uint64_t start = __now;
+    uint64_t slept = __slept;
+    uint32_t calls = __calls;
+    uint64_t longest = 0;
+    size_t received = 0;
+
+    MEASURE(Camera.takePicture());
+    while (!Camera.isEOF() && (received < IMAGE_SIZE)) {
+        MEASURE(received += Camera.readData(data, chunk));
+    }
+    MEASURE(Camera.stopPicture());
+
+    Benchmark_print("camera.image", baud, chunk, received, start, slept, calls, longest);
+}
+
+static uint8_t __data[CHUNK_MAX_SIZE];
+static size_t __chunk;
+static size_t __received;
+static bool __done;
+
+static void Benchmark_onStop(CameraStatus status, size_t result)
+{
+    (void)status;
+    (void)result;
+
+    __done = true;
+}
+
+// Chains the reads from the callback, as a sketch would.
+static void Benchmark_onRead(CameraStatus status, size_t result)
+{
+    if (status != CAMERA_DONE) {
+        __done = true;
+        return;
+    }
+    __received += result;
+    if (!Camera.isEOF() && (__received < IMAGE_SIZE)) {
+        Camera.startReadData(__data, __chunk, Benchmark_onRead);
+    } else {
+        Camera.startStopPicture(Benchmark_onStop);
+    }
+}
+
+static void Benchmark_onPicture(CameraStatus status, size_t result)
+{
+    (void)result;
+
+    if (status != CAMERA_DONE) {
+        __done = true;
+        return;
+    }
+    Camera.startReadData(__data, __chunk, Benchmark_onRead);
+}
+
+// Negotiates from 38400 baud, or from the rate cached by the last run, with
+// answers garbled above linkMax baud, and reads a picture at the rate
+// reached.
+static void Benchmark_negotiate(uint32_t linkMax)
+{
+    static uint8_t data[CHUNK_MAX_SIZE];
+    uint64_t start;
+    uint32_t baud;
+    size_t received = 0;
+
+    __linkMaxBaud = linkMax;
+    start = __now;
+    Camera.begin(CAMERA_BAUD_38400);
+    printf("{\"benchmark\":\"camera.begin\",\"camera_baud\":%u,\"value\":%.1f,\"unit\":\"ms\"}\n",
+           __cameraBaud, (double)(__now - start) / CPU_MHZ / 1000);
+
+    start = __now;
+    baud = Camera.negotiateBaudRate(CAMERA_BAUD_115200);
+    printf("{\"benchmark\":\"camera.negotiate\",\"link_max\":%u,\"baud\":%u,\"value\":%.1f,\"unit\":\"ms\"}\n",
+           linkMax, (baud != 0) ? Benchmark_toBaud(baud) : 0, (double)(__now - start) / CPU_MHZ / 1000);
+
+    Camera.takePicture();
+    while (!Camera.isEOF() && (received < IMAGE_SIZE)) {
+        size_t size = Camera.readData(data, Camera.getOptimalChunkSize(sizeof(data)));
+
+        if (size == 0) {
+            break;
+        }
+        received += size;
+    }
+    Camera.stopPicture();
+    printf("{\"benchmark\":\"camera.throughput\",\"link_max\":%u,\"baud\":%u,\"received\":%u,\"value\":%u,"
+           "\"unit\":\"B/s\"}\n", linkMax, __cameraBaud, (unsigned int)received, Camera.getThroughput());
+}
+
+static void Benchmark_polled(uint32_t baud, size_t chunk)
+{
+    uint64_t start = __now;
+    uint64_t slept = __slept;
+    uint32_t calls = __calls;
+    uint64_t longest = 0;
+
+    __chunk = chunk;
+    __received = 0;
+    __done = false;
+
+    MEASURE(Camera.startPicture(Benchmark_onPicture));
+    // The sketch would do other work in between. Here it sleeps.
+    while (!__done) {
+        sleep(1);
+        MEASURE(Camera.poll());
+    }
+
+    Benchmark_print("camera.poll", baud, chunk, __received, start, slept, calls, longest);
+}
+
+int main(void)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < IMAGE_SIZE; i++) {
+        __image[i] = (uint8_t)(i * 7);
+    }
+    __image[0] = 0xff;
+    __image[1] = 0xd8;
+    __image[IMAGE_SIZE - 2] = 0xff;
+    __image[IMAGE_SIZE - 1] = 0xd9;
+
+    __linkMaxBaud = 115200;
+    for (i = 0; i < sizeof(__bauds) / sizeof(__bauds[0]); i++) {
+        for (j = 0; j < sizeof(__chunkSizes) / sizeof(__chunkSizes[0]); j++) {
+            __cameraBaud = Benchmark_toBaud(__bauds[i]);
+            Camera.begin(__bauds[i]);
+            __rxOverflows = 0;
+            Benchmark_blocking(__bauds[i], __chunkSizes[j]);
+            __rxOverflows = 0;
+            Benchmark_polled(__bauds[i], __chunkSizes[j]);
+        }
+    }
+
+    // The camera comes up at 38400 baud. Later runs start from the cached
+    // rate, which the camera keeps.
+    __cameraBaud = 38400;
+    Benchmark_negotiate(115200);
+    __cameraBaud = 38400;
+    Benchmark_negotiate(57600);
+    Benchmark_negotiate(57600);
+
+    return EXIT_SUCCESS;
+}
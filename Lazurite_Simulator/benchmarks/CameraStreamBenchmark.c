@@ -0,0 +1,350 @@
+#include "CameraStream.h"
+#include "Lazurite_Packet.h"
+#include "LazuriteSimulator.h"
+#include <stdio.h>
+
+// Delivery time of a picture sent with CameraStream, against the time to
+// read it from the camera alone and to send it alone. CameraStream reads
+// the next chunk while the radio sends the previous ones, so it should take
+// about the longer of the two instead of their sum. After each picture
+// the sender asks the sink with a command whether it got the picture
+// complete and intact; only such a picture counts as delivered.
+//
+// A model of the camera answers on Serial3, one byte every 10 bit times of
+// the baud rate, into an RX buffer of RX_BUFFER_SIZE bytes, on the virtual
+// time of the simulator. Link with -Wl,-Bsymbolic, so that LinkSpriteCamera
+// uses it instead of the Serial3 of the simulator. Results are printed as
+// one JSON object per line.
+//
+//   stream,<dst>,<baud>,<rate>    reads and sends a picture in the three ways
+//   sink,<src>,0,<rate>           puts the pictures together
+
+#define PANID           0xabcd
+#define CHANNEL         36
+#define IDLE_TIMEOUT    3000000     // us
+#define QUERY_TIMEOUT   1000        // ms
+#define QUERY_TRIES     3
+#define QUERY_PARAM     "picture"
+#define RX_BUFFER_SIZE  64
+#define RESPONSE_DELAY  100         // us from a command until the answer
+#define IMAGE_SIZE      12000
+#define TX_BUFFER_SIZE  16
+#define READ_ALIGNMENT  8
+#define CHUNK_MAX_SIZE  256
+
+static char __role[16];
+static unsigned int __peer;
+static unsigned int __baud;
+static unsigned int __rate;
+static Packet *__packet;
+static Reassembler __reassembler;
+static uint8_t __picture[IMAGE_SIZE];
+static uint32_t __lastRx;
+static const char *__result = "incomplete";
+static uint8_t __query;
+
+static uint8_t __image[IMAGE_SIZE];
+static uint8_t __command[TX_BUFFER_SIZE];
+static size_t __commandLength;
+
+// The answer of the camera, and when its first byte arrives.
+static uint8_t __answer[16 + CHUNK_MAX_SIZE + READ_ALIGNMENT];
+static size_t __answerLength;
+static size_t __answerNext;
+static uint32_t __answerStart;
+
+static uint8_t __rx[RX_BUFFER_SIZE];
+static size_t __rxHead;
+static size_t __rxCount;
+static uint32_t __rxOverflows;
+
+// Bytes arrive while the sketch works or sleeps.
+static void Camera_update()
+{
+    uint32_t now = micros();
+
+    while ((__answerNext < __answerLength) &&
+           ((int32_t)(now - __answerStart) >= (int32_t)((uint64_t)__answerNext * 10 * 1000000 / __baud))) {
+        if (__rxCount < RX_BUFFER_SIZE) {
+            __rx[(__rxHead + __rxCount) % RX_BUFFER_SIZE] = __answer[__answerNext];
+            __rxCount++;
+        } else {
+            __rxOverflows++;
+        }
+        __answerNext++;
+    }
+}
+
+static void Camera_answer(const uint8_t *data, size_t length)
+{
+    if (__answerNext >= __answerLength) {
+        __answerLength = 0;
+        __answerNext = 0;
+        __answerStart = micros() + RESPONSE_DELAY;
+    }
+    memcpy(&__answer[__answerLength], data, length);
+    __answerLength += length;
+}
+
+static void Camera_execute()
+{
+    static const uint8_t ok[] = { 0x76, 0x00, 0x00, 0x00, 0x00 };
+    static const char boot[] = "Ctrl infr exist\r\nInit end\r\n";
+    uint8_t header[9];
+
+    memcpy(header, ok, sizeof(ok));
+    header[2] = __command[2];
+
+    switch (__command[2]) {
+    case 0x26:
+        Camera_answer(header, 4);
+        Camera_answer((const uint8_t *)boot, sizeof(boot) - 1);
+        break;
+    case 0x34:
+        header[4] = 0x04;
+        header[5] = 0x00;
+        header[6] = 0x00;
+        header[7] = (uint8_t)(IMAGE_SIZE >> 8);
+        header[8] = (uint8_t)(IMAGE_SIZE & 0xff);
+        Camera_answer(header, 9);
+        break;
+    case 0x32: {
+        size_t address = ((size_t)__command[6] << 24) | ((size_t)__command[7] << 16) | ((size_t)__command[8] << 8) | __command[9];
+        size_t length = ((size_t)__command[10] << 24) | ((size_t)__command[11] << 16) | ((size_t)__command[12] << 8) | __command[13];
+        size_t i;
+
+        if ((address % READ_ALIGNMENT != 0) || (length % READ_ALIGNMENT != 0) || (length > CHUNK_MAX_SIZE + READ_ALIGNMENT)) {
+            header[3] = 0x03;
+            Camera_answer(header, sizeof(ok));
+            break;
+        }
+        Camera_answer(header, sizeof(ok));
+        // Past the end of the picture the camera sends padding.
+        for (i = 0; i < length; i++) {
+            uint8_t data = (address + i < IMAGE_SIZE) ? __image[address + i] : 0;
+            Camera_answer(&data, 1);
+        }
+        Camera_answer(header, sizeof(ok));
+        break;
+    }
+    default:
+        Camera_answer(header, sizeof(ok));
+        break;
+    }
+}
+
+static size_t CameraSerial_write_byte(uint8_t data)
+{
+    size_t length;
+
+    __command[__commandLength++] = data;
+    length = (__commandLength < 4) ? TX_BUFFER_SIZE : 4 + (size_t)__command[3];
+    if (__commandLength == length) {
+        Camera_execute();
+        __commandLength = 0;
+    }
+    return 1;
+}
+
+static size_t CameraSerial_write(const uint8_t *data, size_t quantity)
+{
+    size_t i;
+
+    for (i = 0; i < quantity; i++) {
+        CameraSerial_write_byte(data[i]);
+    }
+    return quantity;
+}
+
+static int CameraSerial_available(void)
+{
+    Camera_update();
+    return (int)__rxCount;
+}
+
+static int CameraSerial_read(void)
+{
+    int data;
+
+    Camera_update();
+    if (__rxCount == 0) {
+        return -1;
+    }
+    data = __rx[__rxHead];
+    __rxHead = (__rxHead + 1) % RX_BUFFER_SIZE;
+    __rxCount--;
+    return data;
+}
+
+static void CameraSerial_begin(uint32_t baud) { (void)baud; }
+static void CameraSerial_none(void) {}
+static int CameraSerial_int(void) { return -1; }
+static size_t CameraSerial_print(const char *str) { (void)str; return 0; }
+static size_t CameraSerial_print_long(long data, uint8_t format) { (void)data; (void)format; return 0; }
+
+const HardwareSerial Serial3 = {
+    CameraSerial_begin, CameraSerial_none, CameraSerial_available, CameraSerial_read, CameraSerial_read,
+    CameraSerial_none, CameraSerial_print, CameraSerial_print, CameraSerial_print_long, CameraSerial_print_long,
+    CameraSerial_write, CameraSerial_write_byte, CameraSerial_int
+};
+
+// The picture from the camera into memory, in the chunks of CameraStream.
+static uint32_t Benchmark_read()
+{
+    uint32_t start = micros();
+    size_t received = 0;
+
+    Camera.takePicture();
+    while (!Camera.isEOF() && (received < IMAGE_SIZE)) {
+        size_t size = Camera.readData(&__picture[received], Camera.getOptimalChunkSize(LAZURITE_FRAGMENT_DATA_MAX_SIZE));
+
+        if (size == 0) {
+            break;
+        }
+        received += size;
+    }
+    Camera.stopPicture();
+
+    return micros() - start;
+}
+
+// The picture from memory over the radio, in chunks of getOptimalChunkSize
+// for a fragment, which the sink checks that it can put together.
+static uint32_t Benchmark_send()
+{
+    uint32_t start = micros();
+    size_t chunk = Camera.getOptimalChunkSize(LAZURITE_FRAGMENT_DATA_MAX_SIZE);
+    size_t offset = 0;
+
+    while (offset < IMAGE_SIZE) {
+        size_t capacity;
+        size_t size;
+        uint8_t *data;
+
+        while ((data = Wireless.reserveDataAsync(true, &capacity)) == NULL) {
+            sleep(1);
+        }
+        size = (chunk < capacity) ? chunk : capacity;
+        if (size > IMAGE_SIZE - offset) {
+            size = IMAGE_SIZE - offset;
+        }
+        memcpy(data, &__picture[offset], size);
+        offset += size;
+        Wireless.commitDataAsync(PANID, (uint16_t)__peer, size, offset == IMAGE_SIZE, NULL);
+    }
+    while (Wireless.getTxQueueLength() != 0) {
+        sleep(1);
+    }
+
+    return micros() - start;
+}
+
+// Whether the sink has put the last picture together as it was taken.
+static bool Benchmark_isDelivered()
+{
+    uint8_t command = __query++;
+    uint8_t i;
+
+    for (i = 0; i < QUERY_TRIES; i++) {
+        uint32_t start = millis();
+
+        Wireless.sendCommandWithAck(PANID, (uint16_t)__peer, command, QUERY_PARAM);
+        while ((millis() - start) < QUERY_TIMEOUT) {
+            if ((Wireless.listen(__packet) == 0) && (PACKET_GET_TYPE(__packet) == ACK) &&
+                (ACK_GET_COMMAND(__packet) == command)) {
+                return strcmp(ACK_GET_RESPONSE(__packet), "ok") == 0;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void Benchmark_stream()
+{
+    uint32_t read = Benchmark_read();
+    uint32_t send = Benchmark_send();
+    bool sendDelivered = Benchmark_isDelivered();
+    bool delivered;
+    uint32_t start;
+    uint32_t elapsed;
+    size_t sent;
+
+    start = micros();
+    Camera.takePicture();
+    sent = CameraStream.send(PANID, (uint16_t)__peer);
+    Camera.stopPicture();
+    elapsed = micros() - start;
+    delivered = Benchmark_isDelivered();
+    if (delivered) {
+        SimNode_addGoodput(IMAGE_SIZE);
+    }
+
+    printf("{\"benchmark\":\"camera.stream\",\"baud\":%u,\"rate_kbps\":%u,\"image\":%u,\"sent\":%u,\"failures\":%u,"
+           "\"overflows\":%u,\"delivered\":%s,\"send_delivered\":%s,\"read_ms\":%.1f,\"send_ms\":%.1f,"
+           "\"value\":%.1f,\"unit\":\"ms\"}\n",
+           __baud, __rate, IMAGE_SIZE, (unsigned int)sent, CameraStream.getFailureCount(), __rxOverflows,
+           delivered ? "true" : "false", sendDelivered ? "true" : "false", read / 1000.0, send / 1000.0,
+           elapsed / 1000.0);
+}
+
+static void Benchmark_sink()
+{
+    if (Wireless.listen(__packet) != 0) {
+        if ((__lastRx != 0) && ((micros() - __lastRx) > IDLE_TIMEOUT)) {
+            SimNode_exit();
+        }
+        return;
+    }
+    __lastRx = micros();
+
+    if ((PACKET_GET_TYPE(__packet) == DATA) && PACKET_IS_FRAGMENTED(__packet)) {
+        if (Reassembler_put(&__reassembler, __packet) == REASSEMBLY_COMPLETE) {
+            __result = ((Reassembler_getSize(&__reassembler) == IMAGE_SIZE) &&
+                        (memcmp(__picture, __image, IMAGE_SIZE) == 0)) ? "ok" : "corrupt";
+        }
+    }
+    // The result of the last picture, once.
+    if ((PACKET_GET_TYPE(__packet) == COMMAND) && COMMAND_IS_RESPONSE_REQUESTED(__packet) &&
+        (strcmp(COMMAND_GET_PARAM(__packet), QUERY_PARAM) == 0)) {
+        Wireless.sendAck(PANID, (uint16_t)__peer, COMMAND_GET_COMMAND(__packet), __result);
+        __result = "incomplete";
+    }
+}
+
+void setup(void)
+{
+    size_t i;
+
+    if (sscanf(SimNode_getArgument(), "%15[a-z],%i,%u,%u", __role, &__peer, &__baud, &__rate) != 4) {
+        fprintf(stderr, "bad argument: %s\n", SimNode_getArgument());
+        SimNode_exit();
+    }
+    for (i = 0; i < IMAGE_SIZE; i++) {
+        __image[i] = (uint8_t)(i * 7);
+    }
+    __image[0] = 0xff;
+    __image[1] = 0xd8;
+    __image[IMAGE_SIZE - 2] = 0xff;
+    __image[IMAGE_SIZE - 1] = 0xd9;
+
+    __packet = Packet_new();
+    Reassembler_initialize(&__reassembler, __picture, sizeof(__picture));
+    Wireless.init();
+    Wireless.begin(CHANNEL, PANID, (__rate == 50) ? SUBGHZ_50KBPS : SUBGHZ_100KBPS, SUBGHZ_PWR_20MW);
+    Wireless.enableRx();
+    if (strcmp(__role, "stream") == 0) {
+        Camera.begin((__baud == 115200) ? CAMERA_BAUD_115200 : CAMERA_BAUD_38400);
+    }
+}
+
+void loop(void)
+{
+    if (strcmp(__role, "sink") == 0) {
+        Benchmark_sink();
+        return;
+    }
+
+    Benchmark_stream();
+    SimNode_exit();
+}
@@ -0,0 +1,249 @@
+#include "Lazurite_Wireless.h"
+#include "Lazurite_Packet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Host CPU cost of decoding received packets and of the packet interfaces.
+// The radio replays the last frame sent to it, so listen() decodes the same
+// frame on every call. Results are printed as one JSON object per line.
+// The LZSS round trip is a check: it fails the run if a DATA packet of any
+// size does not come back as it was sent.
+
+#define ITERATIONS  1000000
+
+static uint8_t __frame[256];
+static uint16_t __frameLength;
+static volatile uint32_t __sink;
+
+static SUBGHZ_MSG Radio_ok(void) { return SUBGHZ_OK; }
+static SUBGHZ_MSG Radio_begin(uint8_t ch, uint16_t panid, SUBGHZ_RATE rate, SUBGHZ_POWER txPower) { (void)ch; (void)panid; (void)rate; (void)txPower; return SUBGHZ_OK; }
+static SUBGHZ_MSG Radio_rxEnable(void (*callback)(const uint8_t *data, uint8_t rssi, int status)) { (void)callback; return SUBGHZ_OK; }
+static uint16_t Radio_getMyAddress(void) { return 1; }
+static void Radio_getStatus(SUBGHZ_STATUS *tx, SUBGHZ_STATUS *rx) { (void)tx; (void)rx; }
+static void Radio_msgOut(SUBGHZ_MSG msg) { (void)msg; }
+static SUBGHZ_MSG Radio_param(SUBGHZ_PARAM *param) { (void)param; return SUBGHZ_OK; }
+static SUBGHZ_MSG Radio_bool(bool on) { (void)on; return SUBGHZ_OK; }
+
+static SUBGHZ_MSG Radio_send(uint16_t panid, uint16_t dstAddr, uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status))
+{
+    (void)panid;
+    (void)dstAddr;
+
+    memcpy(__frame, data, len);
+    __frameLength = len;
+    if (callback != NULL) {
+        callback(0, SUBGHZ_OK);
+    }
+    return SUBGHZ_OK;
+}
+
+static short Radio_readData(uint8_t *data, uint16_t max_size)
+{
+    uint16_t length = (__frameLength < max_size) ? __frameLength : max_size;
+
+    memcpy(data, __frame, length);
+    return (short)length;
+}
+
+const SubGHz_CTRL SubGHz = {
+    Radio_ok, Radio_ok, Radio_begin, Radio_ok, Radio_send, Radio_rxEnable, Radio_ok, Radio_readData,
+    Radio_getMyAddress, Radio_getStatus, Radio_msgOut, Radio_param, Radio_param, Radio_bool, Radio_bool, Radio_bool
+};
+
+static void Serial_begin(uint32_t baud) { (void)baud; }
+static void Serial_none(void) {}
+static int Serial_int(void) { return -1; }
+static size_t Serial_print(const char *str) { (void)str; return 0; }
+static size_t Serial_print_long(long data, uint8_t format) { (void)data; (void)format; return 0; }
+static size_t Serial_write(const uint8_t *data, size_t quantity) { (void)data; return quantity; }
+static size_t Serial_write_byte(uint8_t data) { (void)data; return 1; }
+
+const HardwareSerial Serial = {
+    Serial_begin, Serial_none, Serial_int, Serial_int, Serial_int, Serial_none, Serial_print, Serial_print,
+    Serial_print_long, Serial_print_long, Serial_write, Serial_write_byte, Serial_int
+};
+
+uint32_t millis(void) { return 0; }
+uint32_t micros(void) { return 0; }
+void dis_interrupts(uint8_t irq) { (void)irq; }
+void enb_interrupts(uint8_t irq) { (void)irq; }
+void __assert_brk(const char *assertion, const char *file, unsigned int line) { (void)assertion; (void)file; (void)line; }
+
+static int Benchmark_onCommand(const Packet * const packet, uint8_t response[], size_t capacity)
+{
+    (void)packet;
+    (void)response;
+    (void)capacity;
+
+    __sink++;
+    return -1;
+}
+
+static void Benchmark_onPacket(const Packet * const packet)
+{
+    (void)packet;
+
+    __sink++;
+}
+
+static const CommandHandler __commands[] = { Benchmark_onCommand, Benchmark_onCommand };
+static const Dispatcher __dispatcher = {
+    0xabcd, 2,
+    { Benchmark_onPacket, Benchmark_onPacket, Benchmark_onPacket, Benchmark_onPacket },
+    __commands, sizeof(__commands) / sizeof(__commands[0])
+};
+
+static double Benchmark_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void Benchmark_print(const char *name, const char *packet, double start)
+{
+    printf("{\"benchmark\":\"%s\",\"packet\":\"%s\",\"iterations\":%d,\"value\":%.1f,\"unit\":\"ns/call\"}\n",
+           name, packet, ITERATIONS, (Benchmark_now() - start) / ITERATIONS);
+}
+
+static void Benchmark_listen(const char *name, Packet *packet)
+{
+    double start = Benchmark_now();
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        Wireless.listen(packet);
+        __sink += PACKET_GET_HEADER(packet);
+    }
+    Benchmark_print("listen.decode", name, start);
+}
+
+// Sends every size of input up to LAZURITE_DATA_MAX_SIZE with compression
+// and compares what listen() returns.
+static int Benchmark_roundTrip(const char *name, const uint8_t input[], Packet *packet)
+{
+    size_t size;
+    size_t frame = 0;
+    unsigned int mismatches = 0;
+
+    Wireless.setCompression(true);
+    for (size = 1; size <= LAZURITE_DATA_MAX_SIZE; size++) {
+        Wireless.sendData(0xabcd, 2, input, size, false);
+        frame = __frameLength;
+        if ((Wireless.listen(packet) != 0) || (PACKET_GET_TYPE(packet) != DATA) ||
+            (DATA_GET_DATA_SIZE(packet) != size) || (memcmp(DATA_GET_DATA(packet), input, size) != 0)) {
+            mismatches++;
+        }
+    }
+    Wireless.setCompression(false);
+
+    printf("{\"benchmark\":\"lzss.roundtrip\",\"input\":\"%s\",\"sizes\":%d,\"frame%d\":%u,\"value\":%u,\"unit\":\"mismatches\"}\n",
+           name, LAZURITE_DATA_MAX_SIZE, LAZURITE_DATA_MAX_SIZE, (unsigned int)frame, mismatches);
+
+    return (mismatches == 0) ? 0 : -1;
+}
+
+int main(void)
+{
+    static const char text[] = "node=12,temp=23.5,node=13,temp=23.5,node=14,temp=23.6,node=15,temp=23.5";
+    Packet *packet = Packet_new();
+    uint8_t data[LAZURITE_DATA_MAX_SIZE];
+    uint8_t input[LAZURITE_DATA_MAX_SIZE];
+    uint32_t random = 1;
+    int result = 0;
+    size_t i;
+    double start;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    for (i = 0; i < sizeof(input); i++) {
+        input[i] = (uint8_t)text[i % (sizeof(text) - 1)];
+    }
+    result |= Benchmark_roundTrip("text", input, packet);
+    memset(input, 'x', sizeof(input));
+    result |= Benchmark_roundTrip("run", input, packet);
+    for (i = 0; i < sizeof(input); i++) {
+        random = random * 1103515245 + 12345;
+        input[i] = (uint8_t)(random >> 16);
+    }
+    result |= Benchmark_roundTrip("incompressible", input, packet);
+
+    Wireless.sendData(0xabcd, 2, data, 16, false);
+    Benchmark_listen("data16", packet);
+    Wireless.sendData(0xabcd, 2, data, LAZURITE_DATA_MAX_SIZE, false);
+    Benchmark_listen("data238", packet);
+    Wireless.sendCommand(0xabcd, 2, 0x01, "param");
+    Benchmark_listen("command", packet);
+    Wireless.sendNotice(0xabcd, 2, text);
+    Benchmark_listen("notice", packet);
+
+    Wireless.setCompression(true);
+    Wireless.sendNotice(0xabcd, 2, text);
+    Benchmark_listen("notice.compressed", packet);
+    Wireless.setCompression(false);
+
+    // listen() returns the packets of an AGGREGATE frame one at a time, so
+    // every fourth call reads the frame again.
+    Wireless.setAggregation(true, 0);
+    for (i = 0; i < 4; i++) {
+        Wireless.sendCommand(0xabcd, 2, (uint8_t)i, "param");
+    }
+    Wireless.flush();
+    Wireless.setAggregation(false, 0);
+    Benchmark_listen("aggregate4", packet);
+
+    Wireless.sendCommand(0xabcd, 2, 0x01, "param");
+    Wireless.listen(packet);
+
+    start = Benchmark_now();
+    for (i = 0; i < ITERATIONS; i++) {
+        __sink += ((Command *)Packet_getInterface(packet))->getCommand(packet);
+    }
+    Benchmark_print("getInterface.getCommand", "command", start);
+
+    start = Benchmark_now();
+    for (i = 0; i < ITERATIONS; i++) {
+        __sink += COMMAND_GET_COMMAND(packet);
+    }
+    Benchmark_print("COMMAND_GET_COMMAND", "command", start);
+
+    start = Benchmark_now();
+    for (i = 0; i < ITERATIONS; i++) {
+        __sink += ((Command *)Packet_getInterface(packet))->getCommandParamLength(packet);
+    }
+    Benchmark_print("getInterface.getCommandParamLength", "command", start);
+
+    // The loop every application used to write, against the dispatcher.
+    start = Benchmark_now();
+    for (i = 0; i < ITERATIONS; i++) {
+        switch (Packet_getType(packet)) {
+        case COMMAND:
+            switch (((Command *)Packet_getInterface(packet))->getCommand(packet)) {
+            case 0x01:
+                Benchmark_onCommand(packet, NULL, 0);
+                break;
+            default:
+                break;
+            }
+            break;
+        default:
+            Benchmark_onPacket(packet);
+            break;
+        }
+    }
+    Benchmark_print("switch.getInterface", "command", start);
+
+    start = Benchmark_now();
+    for (i = 0; i < ITERATIONS; i++) {
+        Dispatcher_dispatch(&__dispatcher, packet);
+    }
+    Benchmark_print("Dispatcher_dispatch", "command", start);
+
+    Packet_free(packet);
+
+    return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
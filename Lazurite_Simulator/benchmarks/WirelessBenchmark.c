@@ -0,0 +1,438 @@
+#include "Lazurite_Wireless.h"
+#include "Lazurite_Packet.h"
+#include "LazuriteSimulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Benchmarks of the Wireless API on the simulated radio. Results are
+// printed as one JSON object per line.
+//
+//   goodput,<dst>,<count>,<rate>,<loss>   sendData with each payload size
+//   rtt,<dst>,<count>,<rate>,<loss>       sendCommandWithAck until the Ack
+//   loaded,<dst>,<count>,<rate>,<loss>    sendCommand behind a full queue of data
+//   interrupts,<dst>,<count>,<rate>,<loss> an upload with commitDataAsync, with
+//                                         notices sent from a timer interrupt
+//                                         and from the send callbacks
+//   lossy,<dst>,<count>,<rate>,<loss>     transfers with sendDataWithAck, with
+//                                         one sendDataWithAck per fragment and
+//                                         by sending everything again, without
+//                                         retries in the MAC
+//   sink,<src>,0,<rate>,<loss>            receives and answers commands
+//   rawsink,<src>,0,<rate>,<loss>         the sink without retries in the MAC,
+//                                         for lossy
+
+#define PANID           0xabcd
+#define CHANNEL         36
+#define RTT_TIMEOUT     1000000     // us
+#define IDLE_TIMEOUT    3000000     // us
+#define HEARTBEAT_PERIOD    50      // ms
+#define REPLY_INTERVAL      4       // frames
+#define QUERY_TIMEOUT       100     // ms
+#define TRANSFER_SIZE       (8 * LAZURITE_FRAGMENT_DATA_MAX_SIZE)
+#define TRANSFER_ROUNDS     20
+#define QUERY_PARAM         "received"
+
+static const size_t __payloadSizes[] = { 1, 16, 32, 64, 128, 192, LAZURITE_DATA_MAX_SIZE };
+static const size_t __paramSizes[] = { 0, 16, 64, 128 };
+
+static uint8_t __block[LAZURITE_DATA_MAX_SIZE];
+static uint8_t __transfer[TRANSFER_SIZE];
+static uint8_t __reassembly[TRANSFER_SIZE];
+static Reassembler __reassembler;
+static char __param[LAZURITE_COMMAND_PARAM_MAX_LEN + 1];
+static Packet *__packet;
+static Packet *__bulk;
+static char __role[16];
+static unsigned int __peer;
+static unsigned int __count;
+static unsigned int __rate;
+static unsigned int __loss;
+static uint32_t __lastRx;
+static volatile unsigned int __heartbeats;
+static volatile unsigned int __replies;
+static volatile unsigned int __completed;
+static size_t __received;
+static uint8_t __query;
+
+static void Benchmark_goodput()
+{
+    uint8_t i;
+    unsigned int n;
+
+    for (i = 0; i < sizeof(__payloadSizes) / sizeof(__payloadSizes[0]); i++) {
+        size_t size = __payloadSizes[i];
+        uint32_t start = micros();
+        uint32_t elapsed;
+        uint32_t acked = 0;
+
+        for (n = 0; n < __count; n++) {
+            if (Wireless.sendData(PANID, (uint16_t)__peer, __block, size, false) == size) {
+                acked += size;
+            }
+        }
+        elapsed = micros() - start;
+        SimNode_addGoodput(acked);
+
+        printf("{\"benchmark\":\"sendData.goodput\",\"rate_kbps\":%u,\"loss_pct\":%u,\"payload\":%u,"
+               "\"count\":%u,\"delivered\":%u,\"value\":%.0f,\"unit\":\"bit/s\"}\n",
+               __rate, __loss, (unsigned int)size, __count, acked,
+               (elapsed != 0) ? acked * 8.0 * 1000000.0 / elapsed : 0.0);
+    }
+}
+
+static void Benchmark_rtt()
+{
+    uint8_t i;
+    unsigned int n;
+
+    for (i = 0; i < sizeof(__paramSizes) / sizeof(__paramSizes[0]); i++) {
+        size_t size = __paramSizes[i];
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        uint64_t sum = 0;
+        unsigned int received = 0;
+
+        memset(__param, 'x', size);
+        __param[size] = '\0';
+
+        for (n = 0; n < __count; n++) {
+            // The command byte numbers the requests, so that a late Ack is
+            // not taken for the answer to the next one.
+            uint8_t command = (uint8_t)n;
+            uint32_t start = micros();
+            uint32_t rtt = 0;
+
+            Wireless.sendCommandWithAck(PANID, (uint16_t)__peer, command, __param);
+            while ((micros() - start) < RTT_TIMEOUT) {
+                if ((Wireless.listen(__packet) == 0) && (PACKET_GET_TYPE(__packet) == ACK) &&
+                    (ACK_GET_COMMAND(__packet) == command)) {
+                    rtt = micros() - start;
+                    break;
+                }
+            }
+            if (rtt == 0) {
+                continue;
+            }
+            received++;
+            sum += rtt;
+            if (rtt < min) {
+                min = rtt;
+            }
+            if (rtt > max) {
+                max = rtt;
+            }
+        }
+
+        printf("{\"benchmark\":\"command.rtt\",\"rate_kbps\":%u,\"loss_pct\":%u,\"param\":%u,"
+               "\"count\":%u,\"answered\":%u,\"min\":%u,\"max\":%u,\"value\":%.0f,\"unit\":\"us\"}\n",
+               __rate, __loss, (unsigned int)size, __count, received,
+               received ? min : 0, max, received ? (double)sum / received : 0.0);
+    }
+}
+
+// Whether the COMMAND numbered command has been sent since the given time,
+// from the trace.
+static bool Benchmark_isSent(uint8_t command, uint32_t since)
+{
+    TraceEvent events[4];
+    size_t count = Wireless.getTrace(events, sizeof(events) / sizeof(events[0]));
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if ((events[i].direction == TRACE_TX) && ((events[i].header & LAZURITE_PACKET_TYPE_MASK) == COMMAND) &&
+            (events[i].body[LAZURITE_COMMAND_CMD_I] == command) && ((int32_t)(events[i].time - since) >= 0)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void Benchmark_loaded()
+{
+    uint8_t i;
+    unsigned int n;
+
+    for (i = 0; i < sizeof(__paramSizes) / sizeof(__paramSizes[0]); i++) {
+        size_t size = __paramSizes[i];
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        uint64_t sum = 0;
+
+        memset(__param, 'x', size);
+        __param[size] = '\0';
+
+        for (n = 0; n < __count; n++) {
+            uint32_t start;
+            uint32_t latency;
+
+            // An image upload keeps the queue full.
+            while (Wireless.sendAsync(__bulk, PANID, (uint16_t)__peer, NULL) == 0)
+                ;
+            // The command is queued ahead of the data and sendCommand
+            // returns at once, so the time runs until it is done on air.
+            start = micros();
+            Wireless.sendCommand(PANID, (uint16_t)__peer, (uint8_t)n, __param);
+            while (!Benchmark_isSent((uint8_t)n, start)) {
+                millis();
+            }
+            latency = micros() - start;
+
+            sum += latency;
+            if (latency < min) {
+                min = latency;
+            }
+            if (latency > max) {
+                max = latency;
+            }
+        }
+        while (Wireless.getTxQueueLength() != 0) {
+            millis();
+        }
+
+        printf("{\"benchmark\":\"command.loaded\",\"rate_kbps\":%u,\"loss_pct\":%u,\"param\":%u,"
+               "\"count\":%u,\"min\":%u,\"max\":%u,\"value\":%.0f,\"unit\":\"us\"}\n",
+               __rate, __loss, (unsigned int)size, __count, min, max, (double)sum / __count);
+    }
+}
+
+// A heartbeat from the timer interrupt, mostly while queued frames are on
+// air.
+static void Benchmark_onTimer(void)
+{
+    int ret = Wireless.sendNotice(PANID, (uint16_t)__peer, "heartbeat");
+
+    if ((ret == SUBGHZ_OK) || (ret == LAZURITE_TX_QUEUED)) {
+        __heartbeats++;
+    }
+}
+
+// A reply from the callback of a queued frame, which runs while the radio
+// is still taken by the queue.
+static void Benchmark_onSent(const Packet * const packet, uint8_t rssi, uint8_t status)
+{
+    int ret;
+
+    (void)packet;
+    (void)rssi;
+    (void)status;
+
+    if ((++__completed % REPLY_INTERVAL) != 0) {
+        return;
+    }
+    ret = Wireless.sendNotice(PANID, (uint16_t)__peer, "sent");
+    if ((ret == SUBGHZ_OK) || (ret == LAZURITE_TX_QUEUED)) {
+        __replies++;
+    }
+}
+
+static void Benchmark_interrupts()
+{
+    WirelessStats stats;
+    uint32_t start;
+    uint32_t elapsed;
+    unsigned int n;
+
+    Wireless.resetStats();
+    start = micros();
+    timer2.set(HEARTBEAT_PERIOD, Benchmark_onTimer);
+    timer2.start();
+    for (n = 0; n < __count; n++) {
+        size_t capacity;
+        uint8_t *data;
+
+        while ((data = Wireless.reserveDataAsync(false, &capacity)) == NULL) {
+            millis();
+        }
+        memcpy(data, __block, capacity);
+        Wireless.commitDataAsync(PANID, (uint16_t)__peer, capacity, true, Benchmark_onSent);
+    }
+    while (Wireless.getTxQueueLength() != 0) {
+        millis();
+    }
+    timer2.stop();
+    while (Wireless.getTxQueueLength() != 0) {
+        millis();
+    }
+    elapsed = micros() - start;
+    Wireless.getStats(&stats);
+
+    // Every notice queued from an interrupt has gone out, or been counted
+    // as a failure of the MAC.
+    printf("{\"benchmark\":\"send.interrupts\",\"rate_kbps\":%u,\"loss_pct\":%u,\"count\":%u,"
+           "\"data\":%u,\"heartbeats\":%u,\"replies\":%u,\"notices\":%u,\"value\":%.0f,\"unit\":\"us\"}\n",
+           __rate, __loss, __count, stats.txFrames[DATA], __heartbeats, __replies, stats.txFrames[NOTICE],
+           (double)elapsed);
+}
+
+// The whole transfer at once, with selective repeat.
+static bool Benchmark_sendSelective()
+{
+    return Wireless.sendDataWithAck(PANID, (uint16_t)__peer, __transfer, TRANSFER_SIZE) == TRANSFER_SIZE;
+}
+
+// One fragment at a time, each waiting for its own ACK.
+static bool Benchmark_sendStopAndWait()
+{
+    size_t offset;
+
+    for (offset = 0; offset < TRANSFER_SIZE; offset += LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+        size_t size = TRANSFER_SIZE - offset;
+        uint8_t round;
+
+        if (size > LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+            size = LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+        }
+        for (round = 0; Wireless.sendDataWithAck(PANID, (uint16_t)__peer, &__transfer[offset], size) != size; round++) {
+            if (round == TRANSFER_ROUNDS) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Every fragment without ACK, then a command which asks the sink whether
+// the transfer is complete.
+static bool Benchmark_sendAll()
+{
+    uint32_t start;
+    uint8_t command = __query++;
+
+    Wireless.sendData(PANID, (uint16_t)__peer, __transfer, TRANSFER_SIZE, true);
+    Wireless.sendCommandWithAck(PANID, (uint16_t)__peer, command, QUERY_PARAM);
+    start = millis();
+    while ((millis() - start) < QUERY_TIMEOUT) {
+        if ((Wireless.listen(__packet) == 0) && (PACKET_GET_TYPE(__packet) == ACK) &&
+            (ACK_GET_COMMAND(__packet) == command)) {
+            return (size_t)atoi(ACK_GET_RESPONSE(__packet)) == TRANSFER_SIZE;
+        }
+    }
+
+    return false;
+}
+
+static void Benchmark_lossy()
+{
+    static const struct {
+        const char *name;
+        bool (*send)();
+    } schemes[] = {
+        { "selective", Benchmark_sendSelective },
+        { "stopwait", Benchmark_sendStopAndWait },
+        { "resendall", Benchmark_sendAll },
+    };
+    uint8_t i;
+    unsigned int n;
+
+    // The loss of the link is left to the transfer.
+    Wireless.setSendMode(Wireless.getAddrType(), 0);
+
+    for (i = 0; i < sizeof(schemes) / sizeof(schemes[0]); i++) {
+        WirelessStats stats;
+        uint32_t start;
+        uint32_t elapsed;
+        uint32_t delivered = 0;
+
+        Wireless.resetStats();
+        start = micros();
+        for (n = 0; n < __count; n++) {
+            uint8_t round;
+
+            for (round = 0; round < TRANSFER_ROUNDS; round++) {
+                if (schemes[i].send()) {
+                    delivered += TRANSFER_SIZE;
+                    break;
+                }
+            }
+        }
+        elapsed = micros() - start;
+        Wireless.getStats(&stats);
+        SimNode_addGoodput(delivered);
+
+        printf("{\"benchmark\":\"transfer.lossy\",\"rate_kbps\":%u,\"loss_pct\":%u,\"scheme\":\"%s\",\"size\":%u,"
+               "\"count\":%u,\"delivered\":%u,\"frames\":%u,\"value\":%.0f,\"unit\":\"bit/s\"}\n",
+               __rate, __loss, schemes[i].name, (unsigned int)TRANSFER_SIZE, __count, delivered,
+               stats.txFrames[DATA], (elapsed != 0) ? delivered * 8.0 * 1000000.0 / elapsed : 0.0);
+    }
+}
+
+static void Benchmark_sink()
+{
+    if (Wireless.listen(__packet) != 0) {
+        if ((__lastRx != 0) && ((micros() - __lastRx) > IDLE_TIMEOUT)) {
+            SimNode_exit();
+        }
+        return;
+    }
+    __lastRx = micros();
+
+    if ((PACKET_GET_TYPE(__packet) == DATA) && PACKET_IS_FRAGMENTED(__packet)) {
+        if (Reassembler_put(&__reassembler, __packet) == REASSEMBLY_COMPLETE) {
+            __received = Reassembler_getSize(&__reassembler);
+        }
+        if (Reassembler_isAckRequested(&__reassembler)) {
+            Wireless.sendFragmentAck(PANID, (uint16_t)__peer, &__reassembler);
+        }
+    }
+    if ((PACKET_GET_TYPE(__packet) == COMMAND) && COMMAND_IS_RESPONSE_REQUESTED(__packet)) {
+        char response[12] = "ok";
+
+        // The size of the last complete transfer, once.
+        if (strcmp(COMMAND_GET_PARAM(__packet), QUERY_PARAM) == 0) {
+            snprintf(response, sizeof(response), "%u", (unsigned int)__received);
+            __received = 0;
+        }
+        Wireless.sendAck(PANID, (uint16_t)__peer, COMMAND_GET_COMMAND(__packet), response);
+    }
+}
+
+void setup(void)
+{
+    size_t i;
+
+    if (sscanf(SimNode_getArgument(), "%15[a-z],%i,%u,%u,%u", __role, &__peer, &__count, &__rate, &__loss) != 5) {
+        fprintf(stderr, "bad argument: %s\n", SimNode_getArgument());
+        SimNode_exit();
+    }
+    for (i = 0; i < sizeof(__block); i++) {
+        __block[i] = (uint8_t)i;
+    }
+    for (i = 0; i < sizeof(__transfer); i++) {
+        __transfer[i] = (uint8_t)(i * 7);
+    }
+    Reassembler_initialize(&__reassembler, __reassembly, sizeof(__reassembly));
+
+    __packet = Packet_new();
+    __bulk = Packet_new();
+    Packet_setType(__bulk, DATA);
+    ((Data *)Packet_getInterface(__bulk))->setData(__bulk, __block, LAZURITE_DATA_MAX_SIZE);
+    Wireless.init();
+    Wireless.begin(CHANNEL, PANID, (__rate == 50) ? SUBGHZ_50KBPS : SUBGHZ_100KBPS, SUBGHZ_PWR_20MW);
+    Wireless.enableRx();
+    if (strcmp(__role, "rawsink") == 0) {
+        Wireless.setSendMode(Wireless.getAddrType(), 0);
+    }
+}
+
+void loop(void)
+{
+    if ((strcmp(__role, "sink") == 0) || (strcmp(__role, "rawsink") == 0)) {
+        Benchmark_sink();
+        return;
+    }
+
+    if (strcmp(__role, "goodput") == 0) {
+        Benchmark_goodput();
+    } else if (strcmp(__role, "rtt") == 0) {
+        Benchmark_rtt();
+    } else if (strcmp(__role, "loaded") == 0) {
+        Benchmark_loaded();
+    } else if (strcmp(__role, "interrupts") == 0) {
+        Benchmark_interrupts();
+    } else if (strcmp(__role, "lossy") == 0) {
+        Benchmark_lossy();
+    }
+    SimNode_exit();
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Builds the simulator and the benchmarks, runs them and prints the results
+# as JSON lines, e.g. ./run_benchmarks.sh > results.jsonl
+set -e
+
+cd "$(dirname "$0")"
+BUILD=${BUILD:-/tmp/lazurite-benchmarks}
+CC=${CC:-gcc}
+CFLAGS="-O2 -DNDEBUG -I.. -I../../Lazurite_Wireless -I../../DebugUtils -I../../assert"
+COUNT=${COUNT:-100}
+
+mkdir -p "$BUILD"
+$CC -O2 -rdynamic -I.. -o "$BUILD/lazurite_sim" ../lazurite_sim.c ../LazuriteSimulator.c -ldl
+$CC $CFLAGS -shared -fPIC -o "$BUILD/wireless_benchmark.so" ../../Lazurite_Wireless/Lazurite_Wireless.c WirelessBenchmark.c
+$CC $CFLAGS -o "$BUILD/cpu_benchmark" ../../Lazurite_Wireless/Lazurite_Wireless.c CpuBenchmark.c
+$CC $CFLAGS -I../../LinkSpriteCamera -o "$BUILD/camera_benchmark" ../../LinkSpriteCamera/LinkSpriteCamera.c CameraBenchmark.c
+# -Bsymbolic lets the camera driver use the Serial3 of the benchmark.
+$CC $CFLAGS -I../../LinkSpriteCamera -I../../CameraStream -shared -fPIC -Wl,-Bsymbolic \
+    -o "$BUILD/camera_stream_benchmark.so" ../../Lazurite_Wireless/Lazurite_Wireless.c \
+    ../../LinkSpriteCamera/LinkSpriteCamera.c ../../CameraStream/CameraStream.c CameraStreamBenchmark.c
+
+for rate in 100 50; do
+    for loss in 0 5 20; do
+        for bench in goodput rtt loaded interrupts lossy; do
+            # Only the transfers are compared on the worst link.
+            if [ $loss = 20 ] && [ $bench != lossy ]; then
+                continue
+            fi
+            # A send from an interrupt which hangs ends the run at the time
+            # limit, without a record.
+            limit=0
+            if [ $bench = interrupts ]; then
+                limit=$((COUNT * 100 + 10000))
+            fi
+            sink=sink
+            if [ $bench = lossy ]; then
+                sink=rawsink
+            fi
+            "$BUILD/lazurite_sim" -q -s 1 -l $loss -d $limit \
+                "$BUILD/wireless_benchmark.so:1:$bench,2,$COUNT,$rate,$loss" \
+                "$BUILD/wireless_benchmark.so:2:$sink,1,0,$rate,$loss"
+        done
+    done
+done
+
+for baud in 38400 115200; do
+    for rate in 100 50; do
+        "$BUILD/lazurite_sim" -q -s 1 \
+            "$BUILD/camera_stream_benchmark.so:1:stream,2,$baud,$rate" \
+            "$BUILD/camera_stream_benchmark.so:2:sink,1,0,$rate"
+    done
+done
+
+"$BUILD/cpu_benchmark"
+"$BUILD/camera_benchmark"
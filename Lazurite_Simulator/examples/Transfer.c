@@ -0,0 +1,92 @@
+#include "Lazurite_Wireless.h"
+#include "LazuriteSimulator.h"
+#include <stdio.h>
+
+// Sends blocks with Wireless.sendDataWithAck and receives them with a
+// Reassembler.
+//
+//   send,<dst>,<bytes>,<count>[,<fec>]
+//                                 sends <count> blocks of <bytes> to <dst>, with a
+//                                 parity fragment after every <fec> fragments
+//   receive,<src>,<count>         receives <count> blocks from <src>
+
+#define PANID           0xabcd
+#define CHANNEL         36
+#define BLOCK_SIZE_MAX  (64 * 1024)
+#define LINGER_TIME     1000        // ms
+
+static uint8_t __block[BLOCK_SIZE_MAX];
+static Reassembler __reassembler;
+static Packet *__packet;
+static bool __sender;
+static unsigned int __peer;
+static unsigned int __size;
+static unsigned int __count;
+static unsigned int __done;
+static uint32_t __lastRx;
+
+void setup(void)
+{
+    const char *argument = SimNode_getArgument();
+    unsigned int fec = 0;
+    unsigned int i;
+
+    Wireless.init();
+    Wireless.begin(CHANNEL, PANID, SUBGHZ_100KBPS, SUBGHZ_PWR_20MW);
+
+    if (sscanf(argument, "send,%i,%u,%u,%u", &__peer, &__size, &__count, &fec) >= 3) {
+        __sender = true;
+        Wireless.setFec((uint8_t)fec);
+        if (__size > BLOCK_SIZE_MAX) {
+            __size = BLOCK_SIZE_MAX;
+        }
+        for (i = 0; i < __size; i++) {
+            __block[i] = (uint8_t)(i * 7);
+        }
+    } else if (sscanf(argument, "receive,%i,%u", &__peer, &__count) == 2) {
+        __packet = Packet_new();
+        Reassembler_initialize(&__reassembler, __block, sizeof(__block));
+    } else {
+        SimNode_exit();
+    }
+    // The sender listens for the bitmap ACKs.
+    Wireless.enableRx();
+}
+
+void loop(void)
+{
+    if (__sender) {
+        if (__done >= __count) {
+            SimNode_exit();
+        }
+        if (Wireless.sendDataWithAck(PANID, (uint16_t)__peer, __block, __size) == __size) {
+            SimNode_addGoodput(__size);
+        }
+        __done++;
+        return;
+    }
+
+    // The receiver stays a little after the last block, so that it can still
+    // answer the ACK request of a parity fragment.
+    if ((__done >= __count) && ((millis() - __lastRx) > LINGER_TIME)) {
+        SimNode_exit();
+    }
+    if ((Wireless.listen(__packet) != 0) || (Packet_getType(__packet) != DATA)) {
+        return;
+    }
+    __lastRx = millis();
+    switch (Reassembler_put(&__reassembler, __packet)) {
+    case REASSEMBLY_COMPLETE:
+        SimNode_addGoodput(Reassembler_getSize(&__reassembler));
+        __done++;
+        break;
+    case REASSEMBLY_ERROR:
+        Reassembler_reset(&__reassembler);
+        break;
+    default:
+        break;
+    }
+    if (Reassembler_isAckRequested(&__reassembler)) {
+        Wireless.sendFragmentAck(PANID, (uint16_t)__peer, &__reassembler);
+    }
+}
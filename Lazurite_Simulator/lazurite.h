@@ -0,0 +1,123 @@
+#ifndef _LAZURITE_H_
+#define _LAZURITE_H_
+
+// Host stand-in for the Lazurite SDK header. It declares only what the
+// libraries in this repository use. LazuriteSimulator.c implements it.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BIN     2
+#define OCT     8
+#define DEC     10
+#define HEX     16
+
+#define DI_SUBGHZ   1
+#define DI_TIMER    2
+
+typedef enum {
+    SUBGHZ_OK = 0,
+    SUBGHZ_RESET_FAIL,
+    SUBGHZ_SETUP_FAIL,
+    SUBGHZ_SLEEP_FAIL,
+    SUBGHZ_WAKEUP_FAIL,
+    SUBGHZ_MYADDR_FAIL,
+    SUBGHZ_SETFIL_FAIL,
+    SUBGHZ_TX_COMP_FAIL,
+    SUBGHZ_TX_FAIL,
+    SUBGHZ_TX_CCA_FAIL,
+    SUBGHZ_TX_ACK_FAIL,
+    SUBGHZ_RX_ENB_FAIL,
+    SUBGHZ_RX_DIS_FAIL,
+    SUBGHZ_RX_COMP_FAIL,
+    SUBGHZ_PANID,
+    SUBGHZ_ERR_ADDRTYPE,
+    SUBGHZ_TTL_SEND_OVR,
+    SUBGHZ_DUMMY
+} SUBGHZ_MSG;
+
+typedef enum {
+    SUBGHZ_100KBPS = 100,
+    SUBGHZ_50KBPS = 50
+} SUBGHZ_RATE;
+
+typedef enum {
+    SUBGHZ_PWR_20MW = 20,
+    SUBGHZ_PWR_1MW = 1
+} SUBGHZ_POWER;
+
+typedef struct {
+    uint8_t addrType;
+    uint8_t senseTime;
+    uint8_t txRetry;
+    uint16_t txInterval;
+    uint16_t ccaWait;
+} SUBGHZ_PARAM;
+
+typedef struct {
+    uint16_t rssi;
+    uint16_t status;
+} SUBGHZ_STATUS;
+
+typedef struct {
+    SUBGHZ_MSG (*init)(void);
+    SUBGHZ_MSG (*remove)(void);
+    SUBGHZ_MSG (*begin)(uint8_t ch, uint16_t panid, SUBGHZ_RATE rate, SUBGHZ_POWER txPower);
+    SUBGHZ_MSG (*close)(void);
+    SUBGHZ_MSG (*send)(uint16_t panid, uint16_t dstAddr, uint8_t *data, uint16_t len, void (*callback)(uint8_t rssi, uint8_t status));
+    SUBGHZ_MSG (*rxEnable)(void (*callback)(const uint8_t *data, uint8_t rssi, int status));
+    SUBGHZ_MSG (*rxDisable)(void);
+    short (*readData)(uint8_t *data, uint16_t max_size);
+    uint16_t (*getMyAddress)(void);
+    void (*getStatus)(SUBGHZ_STATUS *tx, SUBGHZ_STATUS *rx);
+    void (*msgOut)(SUBGHZ_MSG msg);
+    SUBGHZ_MSG (*setSendMode)(SUBGHZ_PARAM *param);
+    SUBGHZ_MSG (*getSendMode)(SUBGHZ_PARAM *param);
+    SUBGHZ_MSG (*setAckReq)(bool on);
+    SUBGHZ_MSG (*setBroadcastEnb)(bool on);
+    SUBGHZ_MSG (*setPromiscuous)(bool on);
+} SubGHz_CTRL;
+
+typedef struct {
+    void (*begin)(uint32_t baud);
+    void (*end)(void);
+    int (*available)(void);
+    int (*read)(void);
+    int (*peek)(void);
+    void (*flush)(void);
+    size_t (*print)(const char *str);
+    size_t (*println)(const char *str);
+    size_t (*print_long)(long data, uint8_t format);
+    size_t (*println_long)(long data, uint8_t format);
+    size_t (*write)(const uint8_t *data, size_t quantity);
+    size_t (*write_byte)(uint8_t data);
+    int (*tx_available)(void);
+} HardwareSerial;
+
+// Calls callback every ms from the timer interrupt, DI_TIMER, once started.
+typedef struct {
+    void (*set)(uint32_t ms, void (*callback)(void));
+    void (*start)(void);
+    void (*stop)(void);
+} TIMER2;
+
+extern const SubGHz_CTRL SubGHz;
+extern const HardwareSerial Serial;
+extern const HardwareSerial Serial1;
+extern const HardwareSerial Serial2;
+extern const HardwareSerial Serial3;
+extern const TIMER2 timer2;
+
+extern uint32_t millis(void);
+extern uint32_t micros(void);
+extern void delay(uint32_t ms);
+extern void delayMicroseconds(uint32_t us);
+extern void sleep(uint32_t ms);
+extern void dis_interrupts(uint8_t irq);
+extern void enb_interrupts(uint8_t irq);
+extern void wait_event(bool *flag);
+extern void wait_event_timeout(bool *flag, uint32_t ms);
+
+#endif /* _LAZURITE_H_ */
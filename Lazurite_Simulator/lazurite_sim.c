@@ -0,0 +1,107 @@
+#include "LazuriteSimulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] sketch.so:address[:argument] ...\n"
+            "  -d ms        virtual time to run, 0 until every node exits (0)\n"
+            "  -s seed      random seed (1)\n"
+            "  -r kbps      force 50 or 100 kbps for every node\n"
+            "  -l percent   frame loss on every link (0)\n"
+            "  -L us        delivery latency (0)\n"
+            "  -j us        delivery jitter (0)\n"
+            "  -w us        time before CCA senses a frame on air (128)\n"
+            "  -p us        time spent in each call to millis, micros or readData (10)\n"
+            "  -k from:to:loss[:rssi]  override one link, nodes by index\n"
+            "  -n           no collisions\n"
+            "  -q           no report\n"
+            "  -v           print Serial output of the sketches\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    SimulatorConfig config = { 1, 0, 0, 0, 100, 0, 0, true, 128, 10, false };
+    const char *links[SIMULATOR_MAX_NODES * 2];
+    int linkCount = 0;
+    bool quiet = false;
+    int first;
+    int i;
+
+    for (i = 1; (i < argc) && (argv[i][0] == '-'); i++) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : "";
+
+        switch (argv[i][1]) {
+        case 'd': config.duration = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 's': config.seed = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 'r': config.rate = (SUBGHZ_RATE)strtoul(value, NULL, 0); i++; break;
+        case 'l': config.lossPct = (uint8_t)strtoul(value, NULL, 0); i++; break;
+        case 'L': config.latency = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 'j': config.jitter = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 'w': config.ccaWindow = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 'p': config.pollCost = (uint32_t)strtoul(value, NULL, 0); i++; break;
+        case 'k':
+            if (linkCount < (int)(sizeof(links) / sizeof(links[0]))) {
+                links[linkCount++] = value;
+            }
+            i++;
+            break;
+        case 'n': config.collisions = false; break;
+        case 'q': quiet = true; break;
+        case 'v': config.verbose = true; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    first = i;
+    if ((config.rate != 0) && (config.rate != SUBGHZ_50KBPS) && (config.rate != SUBGHZ_100KBPS)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (first >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Simulator.configure(&config);
+
+    for (i = first; i < argc; i++) {
+        char *sketch = argv[i];
+        char *address = strchr(sketch, ':');
+        char *argument = NULL;
+
+        if (address == NULL) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        *address++ = '\0';
+        argument = strchr(address, ':');
+        if (argument != NULL) {
+            *argument++ = '\0';
+        }
+        if (Simulator.addNode(sketch, (uint16_t)strtoul(address, NULL, 0), argument) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < linkCount; i++) {
+        unsigned int from, to, loss, rssi = config.rssi;
+
+        if ((sscanf(links[i], "%u:%u:%u:%u", &from, &to, &loss, &rssi) < 3) ||
+            (from >= Simulator.getNodeCount()) || (to >= Simulator.getNodeCount())) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        Simulator.setLink((uint8_t)from, (uint8_t)to, (uint8_t)loss, (uint8_t)rssi);
+    }
+
+    Simulator.run();
+    if (!quiet) {
+        Simulator.printReport();
+    }
+
+    return EXIT_SUCCESS;
+}
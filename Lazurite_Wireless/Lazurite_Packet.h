@@ -0,0 +1,117 @@
+#ifndef _LAZURITE_PACKET_H_
+#define _LAZURITE_PACKET_H_
+
+#include "Lazurite_Wireless.h"
+
+#define LAZURITE_PAYLOAD_SIZE	        (250 - 11)
+#define LAZURITE_PACKET_HEADER_SIZE     1
+#define LAZURITE_PACKET_BODY_SIZE       (LAZURITE_PAYLOAD_SIZE - LAZURITE_PACKET_HEADER_SIZE)
+
+#define LAZURITE_PACKET_TYPE_I			0
+#define LAZURITE_PACKET_TYPE_MASK		(0x07)
+#define LAZURITE_PACKET_FLAG_I			0
+#define LAZURITE_PACKET_FLAG_MASK		(0xf8)
+#define LAZURITE_PACKET_FLAG_MASK_START	(0x80)
+#define LAZURITE_PACKET_FLAG_MASK_SEQ	(0x40)
+#define LAZURITE_PACKET_FLAG_MASK_COMP	(0x20)
+#define LAZURITE_PACKET_FLAG_MASK_FRAG	(0x10)
+#define LAZURITE_PACKET_FLAG_MASK_ACK	(0x08)
+
+#define LAZURITE_SEQUENCE_TRAILER_SIZE      3
+#define LAZURITE_ADDRESS_UNKNOWN            (0xfffe)
+
+#define LAZURITE_FRAGMENT_HEADER_I          0
+#define LAZURITE_FRAGMENT_HEADER_SIZE       2
+#define LAZURITE_FRAGMENT_DATA_I            (LAZURITE_FRAGMENT_HEADER_I + LAZURITE_FRAGMENT_HEADER_SIZE)
+#define LAZURITE_FRAGMENT_DATA_MAX_SIZE     (LAZURITE_DATA_MAX_SIZE - LAZURITE_FRAGMENT_HEADER_SIZE - LAZURITE_SEQUENCE_TRAILER_SIZE)
+#define LAZURITE_FRAGMENT_FLAG_MASK_LAST    (0x8000)
+#define LAZURITE_FRAGMENT_FLAG_MASK_FEC     (0x4000)
+#define LAZURITE_FRAGMENT_XFER_SHIFT        12
+#define LAZURITE_FRAGMENT_XFER_MASK         (0x3000)
+#define LAZURITE_FRAGMENT_INDEX_MASK        (0x0fff)
+#define LAZURITE_FRAGMENT_MAX_COUNT         (LAZURITE_FRAGMENT_INDEX_MASK + 1)
+#define LAZURITE_TRANSFER_MAX_SIZE          ((size_t)LAZURITE_FRAGMENT_MAX_COUNT * LAZURITE_FRAGMENT_DATA_MAX_SIZE)
+#define LAZURITE_FRAGMENT_ACK_BITMAP_I      (LAZURITE_FRAGMENT_HEADER_I + LAZURITE_FRAGMENT_HEADER_SIZE)
+#define LAZURITE_FRAGMENT_ACK_BITMAP_SIZE   (LAZURITE_FRAGMENT_WINDOW_SIZE / 8)
+#define LAZURITE_FEC_GROUP_SHIFT            3
+#define LAZURITE_FEC_SIZE_MASK              (0x0007)
+#define LAZURITE_FEC_GROUP_MAX_SIZE         (LAZURITE_FEC_SIZE_MASK + 1)
+#define LAZURITE_FEC_GROUP_MAX_COUNT        (LAZURITE_FRAGMENT_MAX_COUNT >> LAZURITE_FEC_GROUP_SHIFT)
+
+#define LAZURITE_ACK_CMD_I	        0
+#define LAZURITE_ACK_COMMAND_SIZE   1
+#define LAZURITE_ACK_RESPONSE_I         (LAZURITE_ACK_CMD_I + LAZURITE_ACK_COMMAND_SIZE)
+#define LAZURITE_ACK_RESPONSE_MAX_LEN   (LAZURITE_PACKET_BODY_SIZE - LAZURITE_ACK_COMMAND_SIZE)
+
+#define LAZURITE_COMMAND_CMD_I          0
+#define LAZURITE_COMMAND_CMD_SIZE       1
+#define LAZURITE_COMMAND_PARAM_I         (LAZURITE_COMMAND_CMD_I + LAZURITE_COMMAND_CMD_SIZE)
+#define LAZURITE_COMMAND_PARAM_MAX_LEN   (LAZURITE_PACKET_BODY_SIZE - LAZURITE_COMMAND_CMD_SIZE)
+
+#define LAZURITE_TLV_HEADER_SIZE        2
+#define LAZURITE_TLV_VALUE_MAX_SIZE     0xff
+
+#define LAZURITE_DATA_MAX_SIZE      (LAZURITE_PACKET_BODY_SIZE)
+
+#define LAZURITE_NOTICE_MAX_SIZE      (LAZURITE_PACKET_BODY_SIZE)
+
+#define LAZURITE_AGGREGATE_HEADER_I     0
+#define LAZURITE_AGGREGATE_LENGTH_I     1
+#define LAZURITE_AGGREGATE_BODY_I       2
+#define LAZURITE_AGGREGATE_RECORD_SIZE  (LAZURITE_AGGREGATE_BODY_I)
+
+// Trace dump: "LZTR", version, body size and event count, then one record
+// per event with the fields of TraceEvent in little endian.
+#define LAZURITE_TRACE_MAGIC            "LZTR"
+#define LAZURITE_TRACE_VERSION          1
+#define LAZURITE_TRACE_HEADER_SIZE      8
+#define LAZURITE_TRACE_RECORD_SIZE      (15 + LAZURITE_TRACE_BODY_SIZE)
+
+
+typedef struct {
+    uint8_t _payload[LAZURITE_PAYLOAD_SIZE+1];
+    size_t _length;
+    uint16_t _srcAddr;
+} Payload;
+
+// Statically dispatched accessors over the Payload layout. They compile to
+// direct loads and stores, whereas the Ack, Command, Data and Notice
+// interfaces returned by Packet_getInterface() cost several calls each.
+// The packet type is not checked, so use the macros of the right type.
+
+#define PACKET_GET_HEADER(p)                (((const Payload *)(p))->_payload[LAZURITE_PACKET_FLAG_I])
+#define PACKET_GET_BODY(p)                  (&((Payload *)(p))->_payload[LAZURITE_PACKET_HEADER_SIZE])
+#define PACKET_GET_BODY_LENGTH(p)           (((const Payload *)(p))->_length)
+#define PACKET_GET_TYPE(p)                  ((PacketType)(PACKET_GET_HEADER(p) & LAZURITE_PACKET_TYPE_MASK))
+#define PACKET_IS_FRAGMENTED(p)             ((PACKET_GET_HEADER(p) & LAZURITE_PACKET_FLAG_MASK_FRAG) != 0)
+#define PACKET_IS_RESPONSE_REQUESTED(p)     ((PACKET_GET_HEADER(p) & LAZURITE_PACKET_FLAG_MASK_ACK) != 0)
+#define PACKET_IS_COMPRESSED(p)             ((PACKET_GET_HEADER(p) & LAZURITE_PACKET_FLAG_MASK_COMP) != 0)
+#define PACKET_GET_SOURCE(p)                (((const Payload *)(p))->_srcAddr)
+#define PACKET_SET_TYPE(p, type)            (((Payload *)(p))->_payload[LAZURITE_PACKET_TYPE_I] = (uint8_t)((PACKET_GET_HEADER(p) & ~LAZURITE_PACKET_TYPE_MASK) | (uint8_t)(type)))
+#define PACKET_SET_BODY_LENGTH(p, length)   (((Payload *)(p))->_length = (length))
+
+#define ACK_GET_COMMAND(p)                  (PACKET_GET_BODY(p)[LAZURITE_ACK_CMD_I])
+#define ACK_GET_RESPONSE(p)                 ((const char *)&PACKET_GET_BODY(p)[LAZURITE_ACK_RESPONSE_I])
+#define ACK_GET_RESPONSE_BYTES(p)           ((const uint8_t *)&PACKET_GET_BODY(p)[LAZURITE_ACK_RESPONSE_I])
+#define ACK_GET_RESPONSE_LENGTH(p)          (PACKET_GET_BODY_LENGTH(p) - LAZURITE_ACK_COMMAND_SIZE)
+#define ACK_SET_COMMAND(p, command)         (PACKET_GET_BODY(p)[LAZURITE_ACK_CMD_I] = (uint8_t)(command))
+
+#define COMMAND_GET_COMMAND(p)              (PACKET_GET_BODY(p)[LAZURITE_COMMAND_CMD_I])
+#define COMMAND_GET_PARAM(p)                ((const char *)&PACKET_GET_BODY(p)[LAZURITE_COMMAND_PARAM_I])
+#define COMMAND_GET_PARAM_BYTES(p)          ((const uint8_t *)&PACKET_GET_BODY(p)[LAZURITE_COMMAND_PARAM_I])
+#define COMMAND_GET_PARAM_LENGTH(p)         (PACKET_GET_BODY_LENGTH(p) - LAZURITE_COMMAND_CMD_SIZE)
+#define COMMAND_IS_RESPONSE_REQUESTED(p)    PACKET_IS_RESPONSE_REQUESTED(p)
+#define COMMAND_SET_COMMAND(p, command)     (PACKET_GET_BODY(p)[LAZURITE_COMMAND_CMD_I] = (uint8_t)(command))
+
+#define DATA_GET_OFFSET(p)                  (PACKET_IS_FRAGMENTED(p) ? LAZURITE_FRAGMENT_DATA_I : 0)
+#define DATA_GET_DATA(p)                    (PACKET_GET_BODY(p) + DATA_GET_OFFSET(p))
+#define DATA_GET_DATA_SIZE(p)               (PACKET_GET_BODY_LENGTH(p) - DATA_GET_OFFSET(p))
+#define DATA_GET_FRAGMENT_HEADER(p)         ((uint16_t)(((uint16_t)PACKET_GET_BODY(p)[LAZURITE_FRAGMENT_HEADER_I] << 8) | PACKET_GET_BODY(p)[LAZURITE_FRAGMENT_HEADER_I + 1]))
+#define DATA_GET_FRAGMENT_INDEX(p)          (PACKET_IS_FRAGMENTED(p) ? (DATA_GET_FRAGMENT_HEADER(p) & LAZURITE_FRAGMENT_INDEX_MASK) : 0)
+#define DATA_IS_PARITY(p)                   (PACKET_IS_FRAGMENTED(p) && ((DATA_GET_FRAGMENT_HEADER(p) & LAZURITE_FRAGMENT_FLAG_MASK_FEC) != 0))
+#define DATA_IS_LAST_FRAGMENT(p)            (!PACKET_IS_FRAGMENTED(p) || ((DATA_GET_FRAGMENT_HEADER(p) & LAZURITE_FRAGMENT_FLAG_MASK_LAST) != 0))
+
+#define NOTICE_GET_NOTICE(p)                ((const char *)PACKET_GET_BODY(p))
+#define NOTICE_GET_NOTICE_LENGTH(p)         PACKET_GET_BODY_LENGTH(p)
+
+#endif /* _LAZURITE_PACKET_H_ */
@@ -1,36 +1,168 @@
 #include "Lazurite_Wireless.h"
+#include "Lazurite_Packet.h"
 #include <DebugUtils.h>
 
-#define LAZURITE_PAYLOAD_SIZE	        (250 - 11)
-#define LAZURITE_PACKET_HEADER_SIZE     1
-#define LAZURITE_PACKET_BODY_SIZE       (LAZURITE_PAYLOAD_SIZE - LAZURITE_PACKET_HEADER_SIZE)
+#ifndef LAZURITE_FRAGMENT_ACK_TIMEOUT
+#define LAZURITE_FRAGMENT_ACK_TIMEOUT       (100)
+#endif /* LAZURITE_FRAGMENT_ACK_TIMEOUT */
+#ifndef LAZURITE_FRAGMENT_MAX_RETRY
+#define LAZURITE_FRAGMENT_MAX_RETRY         (8)
+#endif /* LAZURITE_FRAGMENT_MAX_RETRY */
+
+#ifndef LAZURITE_DISPATCH_RESPONSE_SIZE
+#define LAZURITE_DISPATCH_RESPONSE_SIZE     32
+#endif /* LAZURITE_DISPATCH_RESPONSE_SIZE */
+
+#ifndef LAZURITE_WIRELESS_STATS
+#define LAZURITE_WIRELESS_STATS     1
+#endif /* LAZURITE_WIRELESS_STATS */
+
+#if LAZURITE_WIRELESS_STATS
+#define STATS_COUNT_TX(payload, ret, start)     LazuriteWireless_countTx((payload), (ret), (start))
+#define STATS_COUNT_RX(payload)                 LazuriteWireless_countRx(payload)
+#define STATS_COUNT_RSSI(rssi)                  LazuriteWireless_countRssi(rssi)
+#define STATS_COUNT_RETRY()                     (__stats.retries++)
+#define STATS_COUNT_RECOVERED()                 (__stats.recovered++)
+#define STATS_COUNT_DUPLICATE()                 (__stats.duplicates++)
+#else
+#define STATS_COUNT_TX(payload, ret, start)
+#define STATS_COUNT_RX(payload)
+#define STATS_COUNT_RSSI(rssi)
+#define STATS_COUNT_RETRY()
+#define STATS_COUNT_RECOVERED()
+#define STATS_COUNT_DUPLICATE()
+#endif /* LAZURITE_WIRELESS_STATS */
+
+#define LZSS_MIN_MATCH              3
+#define LZSS_MAX_MATCH              (LZSS_MIN_MATCH + 0xff)
+#define LZSS_HASH_SIZE              64
+#define LZSS_HASH(p)                ((((p)[0] << 4) ^ ((p)[1] << 2) ^ (p)[2]) & (LZSS_HASH_SIZE - 1))
+#define LZSS_EMPTY                  (0xff)
+
+#ifndef LAZURITE_RX_RING_SIZE
+#define LAZURITE_RX_RING_SIZE       4
+#endif /* LAZURITE_RX_RING_SIZE */
+#define LAZURITE_RX_RING_MASK       (LAZURITE_RX_RING_SIZE - 1)
+
+#if (LAZURITE_RX_RING_SIZE & LAZURITE_RX_RING_MASK) != 0
+#error LAZURITE_RX_RING_SIZE must be a power of two.
+#endif
+
+#ifndef LAZURITE_RX_HOLD_SIZE
+#define LAZURITE_RX_HOLD_SIZE       2
+#endif /* LAZURITE_RX_HOLD_SIZE */
+#define LAZURITE_RX_HOLD_MASK       (LAZURITE_RX_HOLD_SIZE - 1)
+
+#if (LAZURITE_RX_HOLD_SIZE == 0) || ((LAZURITE_RX_HOLD_SIZE & LAZURITE_RX_HOLD_MASK) != 0)
+#error LAZURITE_RX_HOLD_SIZE must be a power of two.
+#endif
+
+#ifndef LAZURITE_TX_QUEUE_SIZE
+#define LAZURITE_TX_QUEUE_SIZE      4
+#endif /* LAZURITE_TX_QUEUE_SIZE */
+#define LAZURITE_TX_QUEUE_MASK      (LAZURITE_TX_QUEUE_SIZE - 1)
+
+#if (LAZURITE_TX_QUEUE_SIZE & LAZURITE_TX_QUEUE_MASK) != 0
+#error LAZURITE_TX_QUEUE_SIZE must be a power of two.
+#endif
+
+#ifndef LAZURITE_TX_CONTROL_QUEUE_SIZE
+#define LAZURITE_TX_CONTROL_QUEUE_SIZE  2
+#endif /* LAZURITE_TX_CONTROL_QUEUE_SIZE */
+#define LAZURITE_TX_CONTROL_QUEUE_MASK  (LAZURITE_TX_CONTROL_QUEUE_SIZE - 1)
 
-#define LAZURITE_PACKET_TYPE_I			0
-#define LAZURITE_PACKET_TYPE_MASK		(0x07)
-#define LAZURITE_PACKET_FLAG_I			0
-#define LAZURITE_PACKET_FLAG_MASK		(0x18)
-#define LAZURITE_PACKET_FLAG_MASK_FRAG	(0x10)
-#define LAZURITE_PACKET_FLAG_MASK_ACK	(0x08)
+#if (LAZURITE_TX_CONTROL_QUEUE_SIZE & LAZURITE_TX_CONTROL_QUEUE_MASK) != 0
+#error LAZURITE_TX_CONTROL_QUEUE_SIZE must be a power of two.
+#endif
+
+#ifndef LAZURITE_SEND_CONTEXTS
+#define LAZURITE_SEND_CONTEXTS      2
+#endif /* LAZURITE_SEND_CONTEXTS */
+
+// The interrupts whose handlers may send. The transmit queues are locked
+// against them for the few instructions it takes to add a packet.
+#ifndef LAZURITE_SEND_IRQ
+#define LAZURITE_SEND_IRQ           (DI_SUBGHZ | DI_TIMER)
+#endif /* LAZURITE_SEND_IRQ */
+#define TX_QUEUE_LOCK()             dis_interrupts(LAZURITE_SEND_IRQ)
+#define TX_QUEUE_UNLOCK()           enb_interrupts(LAZURITE_SEND_IRQ)
+#define TX_ACCEPTED(ret)            (((ret) == SUBGHZ_OK) || ((ret) == LAZURITE_TX_QUEUED))
+
+#ifndef LAZURITE_DUPLICATE_CACHE_SIZE
+#define LAZURITE_DUPLICATE_CACHE_SIZE   8
+#endif /* LAZURITE_DUPLICATE_CACHE_SIZE */
+#define LAZURITE_DUPLICATE_CACHE_MASK   (LAZURITE_DUPLICATE_CACHE_SIZE - 1)
+
+#if (LAZURITE_DUPLICATE_CACHE_SIZE & LAZURITE_DUPLICATE_CACHE_MASK) != 0
+#error LAZURITE_DUPLICATE_CACHE_SIZE must be a power of two.
+#endif
+
+#ifndef LAZURITE_TRACE_SIZE
+#define LAZURITE_TRACE_SIZE         16
+#endif /* LAZURITE_TRACE_SIZE */
+#define LAZURITE_TRACE_MASK         (LAZURITE_TRACE_SIZE - 1)
 
-#define LAZURITE_ACK_CMD_I	        0
-#define LAZURITE_ACK_COMMAND_SIZE   1
-#define LAZURITE_ACK_RESPONSE_I         (LAZURITE_ACK_CMD_I + LAZURITE_ACK_COMMAND_SIZE)
-#define LAZURITE_ACK_RESPONSE_MAX_LEN   (LAZURITE_PACKET_BODY_SIZE - LAZURITE_ACK_COMMAND_SIZE)
+#if (LAZURITE_TRACE_SIZE & LAZURITE_TRACE_MASK) != 0
+#error LAZURITE_TRACE_SIZE must be a power of two.
+#endif
+#if LAZURITE_TRACE_SIZE > 128
+#error LAZURITE_TRACE_SIZE must be 128 or less.
+#endif
 
-#define LAZURITE_COMMAND_CMD_I          0
-#define LAZURITE_COMMAND_CMD_SIZE       1
-#define LAZURITE_COMMAND_PARAM_I         (LAZURITE_COMMAND_CMD_I + LAZURITE_COMMAND_CMD_SIZE)
-#define LAZURITE_COMMAND_PARAM_MAX_LEN   (LAZURITE_PACKET_BODY_SIZE - LAZURITE_COMMAND_CMD_SIZE)
+#if LAZURITE_TRACE_SIZE > 0
+#define TRACE_SENT(panid, dstAddr, frame, size, rssi, status)   \
+    LazuriteWireless_trace(TRACE_TX, (panid), __myAddress, (dstAddr), (frame), (size), (rssi), (status))
+#define TRACE_RECEIVED(frame, size, rssi)                       LazuriteWireless_traceRx((frame), (size), (rssi))
+#else
+#define TRACE_SENT(panid, dstAddr, frame, size, rssi, status)
+#define TRACE_RECEIVED(frame, size, rssi)
+#endif /* LAZURITE_TRACE_SIZE */
+
+#ifndef LAZURITE_PACKET_POOL_SIZE
+#define LAZURITE_PACKET_POOL_SIZE   4
+#endif /* LAZURITE_PACKET_POOL_SIZE */
+#define LAZURITE_PACKET_POOL_END    (0xff)
+#define LAZURITE_PACKET_POOL_USED   (0xfe)
+
+#if LAZURITE_PACKET_POOL_SIZE >= LAZURITE_PACKET_POOL_USED
+#error LAZURITE_PACKET_POOL_SIZE must be less than 254.
+#endif
 
-#define LAZURITE_DATA_MAX_SIZE      (LAZURITE_PACKET_BODY_SIZE)
+#ifdef LAZURITE_PACKET_POOL_ISR_SAFE
+#define PACKET_POOL_LOCK()      dis_interrupts(DI_SUBGHZ)
+#define PACKET_POOL_UNLOCK()    enb_interrupts(DI_SUBGHZ)
+#else
+#define PACKET_POOL_LOCK()
+#define PACKET_POOL_UNLOCK()
+#endif /* LAZURITE_PACKET_POOL_ISR_SAFE */
 
-#define LAZURITE_NOTICE_MAX_SIZE      (LAZURITE_PACKET_BODY_SIZE)
 
+typedef struct {
+    Payload _payload;
+    uint16_t _panid;
+    uint16_t _dstAddr;
+    SendCallback _callback;
+    uint32_t _queued;
+} TxRequest;
 
 typedef struct {
-    uint8_t _payload[LAZURITE_PAYLOAD_SIZE+1];
-    size_t _length;
-} Payload;
+    TxRequest *_requests;
+    uint8_t _mask;
+    volatile uint8_t _head;
+    volatile uint8_t _tail;
+} TxQueue;
+
+// Transmit queues, highest priority first.
+#define TX_QUEUE_CONTROL    0
+#define TX_QUEUE_BULK       1
+#define TX_QUEUE_COUNT      2
+
+typedef struct {
+    uint16_t _srcAddr;
+    uint8_t _sequence;
+    bool _used;
+    uint32_t _time;
+} DuplicateEntry;
 
 static uint8_t* Payload_getBodyArray(Payload * const self);
 static size_t Payload_getLength(const Payload * const self);
@@ -39,9 +171,26 @@ static uint8_t* Payload_getPayloadArray(Payload * const self);
 static size_t Payload_getPayloadLength(Payload * const self);
 static bool Payload_isFragmented(const Payload * const self);
 static bool Payload_isResponseRequested(Payload * const self);
+static bool Payload_isCompressed(const Payload * const self);
 static void Payload_setFragmented(Payload * const self, bool fragment);
 static void Payload_setResponseRequested(Payload * const self, bool requested);
+static uint16_t Payload_getFragmentHeader(const Payload * const self);
+static void Payload_setFragmentHeader(Payload * const self, uint8_t transferId, uint16_t index, bool last);
+
+static bool Bitmap_test(const uint8_t bitmap[], uint16_t i);
+static void Bitmap_set(uint8_t bitmap[], uint16_t i);
+static void Bitmap_shift(uint8_t bitmap[], size_t size, uint16_t count);
+
+static int Dispatcher_runCommand(const Dispatcher * const self, CommandHandler handler, const Packet * const packet);
+static int Dispatcher_acknowledge(const Dispatcher * const self, const Packet * const packet, const uint8_t response[], size_t length);
+
+static ReassemblyStatus Reassembler_mark(Reassembler * const self, uint16_t index);
+static ReassemblyStatus Reassembler_putParity(Reassembler * const self, uint16_t header, const uint8_t parity[], size_t size);
+
+static size_t Lzss_compress(const uint8_t src[], size_t size, uint8_t dst[], size_t capacity);
+static int Lzss_decompress(const uint8_t src[], size_t size, uint8_t dst[], size_t capacity);
 static void Payload_setPacketType(Payload * const self, PacketType type);
+static void Payload_setCompressed(Payload * const self, bool compressed);
 // static void Payload_setPayload(Payload * const self, uint8_t from[], size_t length);
 // static void Payload_resetPayloadLength(Payload * const self, size_t length);
 static void Payload_resetLength(Payload * const self, size_t length);
@@ -50,14 +199,48 @@ static SUBGHZ_MSG LazuriteWireless_init();
 static SUBGHZ_MSG LazuriteWireless_begin(uint8_t ch, uint16_t panid, SUBGHZ_RATE rate, SUBGHZ_POWER txPower);
 static SUBGHZ_MSG LazuriteWireless_end();
 static int LazuriteWireless_listen(Packet *packet);
+static int LazuriteWireless_poll(Packet *packet);
+static int LazuriteWireless_receive(Packet *packet);
+static int LazuriteWireless_pollRing(Packet *packet);
+static void LazuriteWireless_hold(const Payload * const payload);
+static int LazuriteWireless_takeHeld(Payload * const payload);
+static const Packet* LazuriteWireless_peek();
+static uint16_t LazuriteWireless_getRxOverflowCount();
+static int LazuriteWireless_readPayload(Payload * const payload, uint8_t rssi);
 static SUBGHZ_MSG LazuriteWireless_send(const Packet * const packet, uint16_t panid, uint16_t dstAddr);
+static int LazuriteWireless_sendAsync(const Packet * const packet, uint16_t panid, uint16_t dstAddr, SendCallback callback);
+static uint8_t LazuriteWireless_getTxQueueLength();
+static void LazuriteWireless_startTx();
+static void LazuriteWireless_completeTx(uint8_t rssi, uint8_t status);
+static void LazuriteWireless_waitTxRoom();
 static size_t LazuriteWireless_sendData(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size, bool fragmented);
+static size_t LazuriteWireless_sendFragments(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size);
+static size_t LazuriteWireless_sendDataWithAck(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size);
+static size_t LazuriteWireless_transferWithAck(Payload * const payload, uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size);
+static SUBGHZ_MSG LazuriteWireless_sendFragment(Payload * const payload, uint16_t panid, uint16_t dstAddr, uint8_t transferId, const uint8_t data[], size_t size, uint16_t index, bool requested, bool retry);
+static bool LazuriteWireless_isParityDue(uint16_t index, uint16_t count);
+static SUBGHZ_MSG LazuriteWireless_sendParity(Payload * const payload, uint16_t panid, uint16_t dstAddr, uint8_t transferId, const uint8_t data[], size_t size, uint16_t index, uint16_t count, bool requested);
+static int LazuriteWireless_sendFragmentAck(uint16_t panid, uint16_t dstAddr, Reassembler * const reassembler);
+static int LazuriteWireless_waitFragmentAck(uint8_t transferId, uint16_t *base, uint8_t bitmap[], bool *completed);
+static uint8_t* LazuriteWireless_reserveData(bool fragmented, size_t *capacity);
+static size_t LazuriteWireless_commitData(uint16_t panid, uint16_t dstAddr, size_t size, bool last);
+static uint8_t* LazuriteWireless_reserveDataAsync(bool fragmented, size_t *capacity);
+static int LazuriteWireless_commitDataAsync(uint16_t panid, uint16_t dstAddr, size_t size, bool last, SendCallback callback);
+static void LazuriteWireless_cancelDataAsync();
+static void LazuriteWireless_setStreamHeader(Payload * const payload, bool last);
+static bool LazuriteWireless_enqueueTx(TxQueue * const queue, uint16_t panid, uint16_t dstAddr, SendCallback callback);
+static Payload* LazuriteWireless_enterSend();
+static void LazuriteWireless_leaveSend();
 static int LazuriteWireless_sendCommand(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[]);
 static int LazuriteWireless_sendCommandWithAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[]);
 static int LazuriteWireless_sendAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char response[]);
+static int LazuriteWireless_sendBinaryCommand(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t param[], size_t length, bool ackRequested);
+static int LazuriteWireless_sendBinaryAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t response[], size_t length);
 static int LazuriteWireless_sendNotice(uint16_t panid, uint16_t dstAddr, const char notice[]);
 static SUBGHZ_MSG LazuriteWireless_enableRx();
 static SUBGHZ_MSG LazuriteWireless_disableRx();
+static SUBGHZ_MSG LazuriteWireless_enableRxRing();
+static void LazuriteWireless_rxCallback(const uint8_t *data, uint8_t rssi, int status);
 static uint8_t LazuriteWireless_getAddrType();
 static uint16_t LazuriteWireless_getMyAddress();
 static SUBGHZ_MSG LazuriteWireless_setAckReq(bool on);
@@ -66,6 +249,37 @@ static SUBGHZ_MSG LazuriteWireless_setPromiscuous(bool on);
 static uint8_t LazuriteWireless_setTxRetry();
 static SUBGHZ_MSG LazuriteWireless_setSendMode(uint8_t addrType, uint8_t txRetry);
 static void LazuriteWireless_callback(uint8_t rssi, uint8_t status);
+static void LazuriteWireless_setCompression(bool on);
+static uint8_t LazuriteWireless_getCompressionRatio();
+static void LazuriteWireless_compress(Payload * const payload);
+static int LazuriteWireless_expand(Payload * const payload);
+static void LazuriteWireless_setAggregation(bool on, uint16_t deadline);
+static SUBGHZ_MSG LazuriteWireless_aggregate(Payload * const payload, uint16_t panid, uint16_t dstAddr);
+static SUBGHZ_MSG LazuriteWireless_flush();
+static void LazuriteWireless_setFec(uint8_t groupSize);
+static void LazuriteWireless_setDuplicateFilter(bool on, uint16_t expiry);
+static uint8_t* LazuriteWireless_getFrame(const Payload * const payload, size_t *size);
+static size_t LazuriteWireless_getBodyMaxSize();
+static void LazuriteWireless_fitBody(Payload * const payload);
+static bool LazuriteWireless_isDuplicate(Payload * const payload);
+static void LazuriteWireless_flushIfDue();
+static int LazuriteWireless_split(Payload * const payload);
+static int LazuriteWireless_unpack(Payload * const payload);
+static void LazuriteWireless_getStats(WirelessStats *stats);
+static void LazuriteWireless_resetStats();
+static int LazuriteWireless_sendStats(uint16_t panid, uint16_t dstAddr);
+static void LazuriteWireless_countTx(const Payload * const payload, uint8_t status, uint32_t start);
+static void LazuriteWireless_countRx(const Payload * const payload);
+static void LazuriteWireless_countRssi(uint8_t rssi);
+static size_t LazuriteWireless_formatNumber(char buffer[], size_t size, size_t pos, uint32_t number, char separator);
+static size_t LazuriteWireless_formatText(char buffer[], size_t size, size_t pos, const char *text);
+static void LazuriteWireless_setTrace(bool on);
+static size_t LazuriteWireless_getTrace(TraceEvent events[], size_t count);
+static size_t LazuriteWireless_dumpTrace();
+#if LAZURITE_TRACE_SIZE > 0
+static void LazuriteWireless_trace(TraceDirection direction, uint16_t panid, uint16_t srcAddr, uint16_t dstAddr, const uint8_t frame[], size_t size, uint8_t rssi, uint8_t status);
+static void LazuriteWireless_traceRx(const uint8_t frame[], size_t size, uint8_t rssi);
+#endif /* LAZURITE_TRACE_SIZE */
 
 static uint8_t Ack_getCommand(const Packet * const self);
 static const char* Ack_getResponse(const Packet * const self);
@@ -74,6 +288,8 @@ static size_t Ack_getResponseLength(const Packet * const self);
 static void Ack_initialize(Packet * const self);
 static void Ack_setCommand(Packet * const self, uint8_t command);
 static size_t Ack_setResponse(Packet * const self, const char response[]);
+static const uint8_t* Ack_getResponseBytes(const Packet * const self);
+static size_t Ack_setResponseBytes(Packet * const self, const uint8_t response[], size_t length);
 // static int Ack_resetResponseLength(Packet * const self, size_t length);
 static void Command_initialize(Packet * const self);
 static void Command_enableAckRequest(Packet * const self);
@@ -84,6 +300,8 @@ static size_t Command_getCommandParamLength(const Packet * const self);
 static void Command_setCommand(Packet * const self, uint8_t command);
 static size_t Command_setCommandParam(Packet * const self, const char param[]);
 static void Command_setResponseRequested(Packet * const self, bool requested);
+static const uint8_t* Command_getCommandParamBytes(const Packet * const self);
+static size_t Command_setCommandParamBytes(Packet * const self, const uint8_t param[], size_t length);
 // static int Command_resetCommandParamLength(Packet * const self, size_t length);
 static void Data_initialize(Packet * const self);
 static bool Data_isFragmented(const Packet * const self);
@@ -93,6 +311,10 @@ static size_t Data_getDataSize(const Packet * const self);
 static size_t Data_setData(Packet * const self, const uint8_t from[], size_t size);
 static void Data_setFragmented(Packet * const self, bool fragmented);
 static int Data_resetDataSize(Packet * const self, size_t size);
+static uint16_t Data_getFragmentIndex(const Packet * const self);
+static bool Data_isLastFragment(const Packet * const self);
+static size_t Data_getDataOffset(const Packet * const self);
+static size_t Data_getDataMaxSize(const Packet * const self);
 static const char* Notice_getNotice(const Packet * const self);
 // static char* Notice_getNoticeArray(Packet * const self);
 static size_t Notice_getNoticeLength(const Packet * const self);
@@ -106,12 +328,27 @@ const LazuriteWireless Wireless = {
     LazuriteWireless_end,
     LazuriteWireless_enableRx,
     LazuriteWireless_disableRx,
+    LazuriteWireless_enableRxRing,
     LazuriteWireless_listen,
+    LazuriteWireless_poll,
+    LazuriteWireless_peek,
+    LazuriteWireless_getRxOverflowCount,
     LazuriteWireless_send,
+    LazuriteWireless_sendAsync,
+    LazuriteWireless_getTxQueueLength,
     LazuriteWireless_sendData,
+    LazuriteWireless_sendDataWithAck,
+    LazuriteWireless_sendFragmentAck,
+    LazuriteWireless_reserveData,
+    LazuriteWireless_commitData,
+    LazuriteWireless_reserveDataAsync,
+    LazuriteWireless_commitDataAsync,
+    LazuriteWireless_cancelDataAsync,
     LazuriteWireless_sendCommand,
     LazuriteWireless_sendCommandWithAck,
     LazuriteWireless_sendAck,
+    LazuriteWireless_sendBinaryCommand,
+    LazuriteWireless_sendBinaryAck,
     LazuriteWireless_sendNotice,
     LazuriteWireless_getAddrType,
     LazuriteWireless_getMyAddress,
@@ -119,11 +356,96 @@ const LazuriteWireless Wireless = {
     LazuriteWireless_setBroadcastEnb,
     LazuriteWireless_setPromiscuous,
     LazuriteWireless_setTxRetry,
-    LazuriteWireless_setSendMode
+    LazuriteWireless_setSendMode,
+    LazuriteWireless_setCompression,
+    LazuriteWireless_getCompressionRatio,
+    LazuriteWireless_setAggregation,
+    LazuriteWireless_flush,
+    LazuriteWireless_setFec,
+    LazuriteWireless_setDuplicateFilter,
+    LazuriteWireless_getStats,
+    LazuriteWireless_resetStats,
+    LazuriteWireless_sendStats,
+    LazuriteWireless_setTrace,
+    LazuriteWireless_getTrace,
+    LazuriteWireless_dumpTrace
 };
 
-static Payload __payload;
-static Packet * __packet = (Packet *)&__payload;
+static Payload __reserved;
+static Packet * __packet = (Packet *)&__reserved;
+static Payload __sendSlots[LAZURITE_SEND_CONTEXTS];
+static volatile uint8_t __sendDepth;
+static Payload __response;
+static uint8_t __transferId;
+static uint8_t __streamTransferId;
+static uint16_t __streamIndex;
+
+static Payload __rxRing[LAZURITE_RX_RING_SIZE];
+static Payload __rxDiscard;
+static volatile uint8_t __rxHead;
+static volatile uint8_t __rxTail;
+static volatile uint16_t __rxOverflow;
+static bool __rxRingEnabled;
+static Payload __rxHold[LAZURITE_RX_HOLD_SIZE];
+static uint8_t __rxHoldHead;
+static uint8_t __rxHoldTail;
+
+#if LAZURITE_PACKET_POOL_SIZE > 0
+static Payload __pool[LAZURITE_PACKET_POOL_SIZE];
+static uint8_t __poolNext[LAZURITE_PACKET_POOL_SIZE];
+static uint8_t __poolFree = LAZURITE_PACKET_POOL_END;
+static bool __poolReady;
+#endif /* LAZURITE_PACKET_POOL_SIZE */
+static uint8_t __poolUsed;
+static uint8_t __poolHighWaterMark;
+static uint16_t __poolFailures;
+
+static uint8_t __scratch[LAZURITE_PACKET_BODY_SIZE];
+static bool __scratchBusy;
+static bool __compression;
+static uint32_t __compressionIn;
+static uint32_t __compressionOut;
+
+static Payload __aggregate;
+static uint16_t __aggregatePanid;
+static uint16_t __aggregateDstAddr;
+static uint32_t __aggregateStart;
+static uint16_t __aggregateDeadline;
+static uint8_t __aggregateCount;
+static bool __aggregation;
+static volatile bool __aggregating;
+static uint8_t __fecGroupSize;
+
+static DuplicateEntry __duplicates[LAZURITE_DUPLICATE_CACHE_SIZE];
+static bool __duplicateFilter;
+static uint16_t __duplicateExpiry;
+static uint16_t __myAddress;
+static uint8_t __txSequence;
+static uint8_t __txFrame[LAZURITE_PAYLOAD_SIZE];
+static Payload __rxAggregate;
+static size_t __rxAggregateOffset;
+
+static WirelessStats __stats = { {0}, {0}, {0}, {0}, {0}, 0, 0, 0, 0xff, 0, 0, 0, {0} };
+
+static TxRequest __txBulk[LAZURITE_TX_QUEUE_SIZE];
+static TxRequest __txControl[LAZURITE_TX_CONTROL_QUEUE_SIZE];
+static TxQueue __txQueues[TX_QUEUE_COUNT] = {
+    { __txControl, LAZURITE_TX_CONTROL_QUEUE_MASK, 0, 0 },
+    { __txBulk, LAZURITE_TX_QUEUE_MASK, 0, 0 }
+};
+static TxQueue * volatile __txCurrent = &__txQueues[TX_QUEUE_BULK];
+static volatile bool __txBusy;
+static volatile bool __txReserved;
+static const uint8_t *__txData;
+static size_t __txSize;
+static uint16_t __panid;
+
+#if LAZURITE_TRACE_SIZE > 0
+static TraceEvent __trace[LAZURITE_TRACE_SIZE];
+static uint8_t __traceHead;
+static uint8_t __traceCount;
+static bool __traceEnabled = true;
+#endif /* LAZURITE_TRACE_SIZE */
 
 
 
@@ -143,6 +465,8 @@ static SUBGHZ_MSG LazuriteWireless_begin(uint8_t ch, uint16_t panid, SUBGHZ_RATE
 
     ret = SubGHz.begin(ch, panid, rate, txPower);
     assert(ret == SUBGHZ_OK);
+    __panid = panid;
+    __myAddress = SubGHz.getMyAddress();
 
     return ret;
 }
@@ -158,112 +482,891 @@ static SUBGHZ_MSG LazuriteWireless_end()
 }
 
 static int LazuriteWireless_listen(Packet *packet)
+{
+    if (LazuriteWireless_takeHeld((Payload *)packet) == 0) {
+        return 0;
+    }
+
+    return LazuriteWireless_receive(packet);
+}
+
+static int LazuriteWireless_poll(Packet *packet)
+{
+    LazuriteWireless_flushIfDue();
+
+    if (LazuriteWireless_takeHeld((Payload *)packet) == 0) {
+        return 0;
+    }
+
+    return LazuriteWireless_pollRing(packet);
+}
+
+// Receives the next packet, without the packets held by hold().
+static int LazuriteWireless_receive(Packet *packet)
 {
     int ret = 0;
-    uint8_t *payload = Payload_getPayloadArray((Payload *)packet);
-    short size = LAZURITE_PAYLOAD_SIZE;
 
-    size = SubGHz.readData(payload, LAZURITE_PAYLOAD_SIZE);
+    LazuriteWireless_flushIfDue();
 
-    if (size > 0) {
-        DEBUG_WRITE(payload, size);
-        Payload_resetLength((Payload *)packet, (size_t)size);
-    } else {
+    if (__rxRingEnabled) {
+        return LazuriteWireless_pollRing(packet);
+    }
+    if (LazuriteWireless_unpack((Payload *)packet) == 0) {
+        return 0;
+    }
+
+    ret = LazuriteWireless_readPayload((Payload *)packet, 0);
+    if (ret == 0) {
+        DEBUG_WRITE(Payload_getPayloadArray((Payload *)packet), Payload_getPayloadLength((Payload *)packet));
+        ret = LazuriteWireless_expand((Payload *)packet);
+    }
+    if ((ret == 0) && (Payload_getPacketType((Payload *)packet) == AGGREGATE)) {
+        ret = LazuriteWireless_split((Payload *)packet);
+    }
+
+    return ret;
+}
+
+static int LazuriteWireless_pollRing(Packet *packet)
+{
+    Payload *slot;
+    uint8_t tail = __rxTail;
+    int ret = 0;
+
+    if (LazuriteWireless_unpack((Payload *)packet) == 0) {
+        return 0;
+    }
+    if (tail == __rxHead) {
+        return -1;
+    }
+
+    slot = &__rxRing[tail & LAZURITE_RX_RING_MASK];
+    if ((packet != NULL) && (LazuriteWireless_expand(slot) != 0)) {
+        packet = NULL;
         ret = -1;
     }
+    if (packet != NULL) {
+        Payload * const payload = (Payload *)packet;
+        size_t length = Payload_getPayloadLength(slot);
+        memcpy(payload->_payload, slot->_payload, length + 1);
+        payload->_length = slot->_length;
+        payload->_srcAddr = slot->_srcAddr;
+    }
+    __rxTail = tail + 1;
+
+    if ((packet != NULL) && (Payload_getPacketType((Payload *)packet) == AGGREGATE)) {
+        ret = LazuriteWireless_split((Payload *)packet);
+    }
 
     return ret;
 }
 
+// Packets received while sendDataWithAck waits for its ACK are held for
+// listen, poll and peek, which return them first. When the hold is full,
+// they count as an overflow of the ring.
+static void LazuriteWireless_hold(const Payload * const payload)
+{
+    uint8_t head = __rxHoldHead;
+
+    if ((uint8_t)(head - __rxHoldTail) >= LAZURITE_RX_HOLD_SIZE) {
+        dis_interrupts(DI_SUBGHZ);
+        __rxOverflow++;
+        enb_interrupts(DI_SUBGHZ);
+        return;
+    }
+    memcpy(&__rxHold[head & LAZURITE_RX_HOLD_MASK], payload, sizeof(Payload));
+    __rxHoldHead = head + 1;
+}
+
+static int LazuriteWireless_takeHeld(Payload * const payload)
+{
+    uint8_t tail = __rxHoldTail;
+
+    if (tail == __rxHoldHead) {
+        return -1;
+    }
+    if (payload != NULL) {
+        memcpy(payload, &__rxHold[tail & LAZURITE_RX_HOLD_MASK], sizeof(Payload));
+    }
+    __rxHoldTail = tail + 1;
+
+    return 0;
+}
+
+static const Packet* LazuriteWireless_peek()
+{
+    uint8_t tail = __rxTail;
+    Payload *slot;
+
+    if (__rxHoldTail != __rxHoldHead) {
+        return (const Packet *)&__rxHold[__rxHoldTail & LAZURITE_RX_HOLD_MASK];
+    }
+    if (tail == __rxHead) {
+        return NULL;
+    }
+
+    slot = &__rxRing[tail & LAZURITE_RX_RING_MASK];
+    LazuriteWireless_expand(slot);
+
+    return (const Packet *)slot;
+}
+
+static uint16_t LazuriteWireless_getRxOverflowCount()
+{
+    return __rxOverflow;
+}
+
+static int LazuriteWireless_readPayload(Payload * const payload, uint8_t rssi)
+{
+    short size;
+
+    size = SubGHz.readData(payload->_payload, LAZURITE_PAYLOAD_SIZE);
+    if (size < LAZURITE_PACKET_HEADER_SIZE) {
+        return -1;
+    }
+    TRACE_RECEIVED(payload->_payload, (size_t)size, rssi);
+
+    payload->_payload[size] = 0;
+    payload->_srcAddr = LAZURITE_ADDRESS_UNKNOWN;
+    Payload_resetLength(payload, (size_t)size - LAZURITE_PACKET_HEADER_SIZE);
+    if (LazuriteWireless_isDuplicate(payload)) {
+        return -1;
+    }
+    STATS_COUNT_RX(payload);
+
+    return 0;
+}
+
 static SUBGHZ_MSG LazuriteWireless_send(const Packet * const packet, uint16_t panid, uint16_t dstAddr)
 {
     SUBGHZ_MSG ret = 0;
-    const uint8_t *data = Payload_getPayloadArray((Payload *)packet);
-    size_t size = Payload_getPayloadLength((Payload *)packet);
+    uint8_t *data;
+    size_t size;
+    uint32_t start;
+    bool busy;
+
+    // The radio sends one frame at a time. While it is busy, with a blocking
+    // send or with the queues, the packet is put in the queue of sendAsync
+    // instead of waiting: an interrupt handler, including the callback of a
+    // queued frame, would wait forever for the send it interrupted. Control
+    // packets go out as soon as the frame on air is done, ahead of the
+    // queued data, and data stays in order behind it. The caller gets
+    // LAZURITE_TX_QUEUED, as the frame is not on air yet, and completeTx
+    // counts its outcome.
+    TX_QUEUE_LOCK();
+    busy = __txBusy;
+    __txBusy = true;
+    TX_QUEUE_UNLOCK();
+    if (busy) {
+        return (LazuriteWireless_sendAsync(packet, panid, dstAddr, NULL) == 0) ? LAZURITE_TX_QUEUED : SUBGHZ_TX_FAIL;
+    }
 
+    data = LazuriteWireless_getFrame((const Payload *)packet, &size);
+    start = millis();
     ret = SubGHz.send(panid, dstAddr, data, (uint16_t)size, NULL);
-    Serial.println_long((long)ret, DEC);
+    STATS_COUNT_TX((const Payload *)packet, (uint8_t)ret, start);
+    TRACE_SENT(panid, dstAddr, data, size, 0, (uint8_t)ret);
+    DEBUG_PRINT_LONG((long)ret, DEC);
     assert(ret == SUBGHZ_OK);
 
+    // Hand the radio to the packets queued meanwhile.
+    LazuriteWireless_startTx();
+
     return ret;
 }
 
+// Every send builds its packet in the slot of its nesting level. A handler
+// which interrupts a send gets the next slot, and returns before the
+// interrupted send goes on, so the slots are freed in reverse order and the
+// counter needs no lock.
+static Payload* LazuriteWireless_enterSend()
+{
+    uint8_t depth = __sendDepth++;
+
+    if (depth >= LAZURITE_SEND_CONTEXTS) {
+        DEBUG_PRINT("No send slot left.");
+        return NULL;
+    }
+
+    return &__sendSlots[depth];
+}
+
+static void LazuriteWireless_leaveSend()
+{
+    __sendDepth--;
+}
+
+static int LazuriteWireless_sendAsync(const Packet * const packet, uint16_t panid, uint16_t dstAddr, SendCallback callback)
+{
+    const Payload * const payload = (const Payload *)packet;
+    TxQueue *queue = &__txQueues[(Payload_getPacketType(payload) == DATA) ? TX_QUEUE_BULK : TX_QUEUE_CONTROL];
+    TxRequest *request;
+    uint8_t tail;
+    bool start;
+
+    // The entry is claimed and filled under the lock, so that a handler
+    // which sends from an interrupt cannot take the same one. Data waits
+    // while an entry is reserved by reserveDataAsync.
+    TX_QUEUE_LOCK();
+    tail = queue->_tail;
+    if (((uint8_t)(tail - queue->_head) > queue->_mask) || ((queue == &__txQueues[TX_QUEUE_BULK]) && __txReserved)) {
+        TX_QUEUE_UNLOCK();
+        return -1;
+    }
+
+    request = &queue->_requests[tail & queue->_mask];
+    memcpy(request->_payload._payload, payload->_payload, Payload_getPayloadLength((Payload *)payload));
+    request->_payload._length = payload->_length;
+    start = LazuriteWireless_enqueueTx(queue, panid, dstAddr, callback);
+    TX_QUEUE_UNLOCK();
+
+    if (start) {
+        LazuriteWireless_startTx();
+    }
+
+    return 0;
+}
+
+// Queues the entry at the tail, under TX_QUEUE_LOCK. Returns true when the
+// radio is idle and the caller has to start it.
+static bool LazuriteWireless_enqueueTx(TxQueue * const queue, uint16_t panid, uint16_t dstAddr, SendCallback callback)
+{
+    uint8_t tail = queue->_tail;
+    TxRequest *request = &queue->_requests[tail & queue->_mask];
+    bool start;
+
+    request->_panid = panid;
+    request->_dstAddr = dstAddr;
+    request->_callback = callback;
+    request->_queued = millis();
+
+    queue->_tail = tail + 1;
+    start = !__txBusy;
+    __txBusy = true;
+
+    return start;
+}
+
+static uint8_t LazuriteWireless_getTxQueueLength()
+{
+    uint8_t length = 0;
+    uint8_t i;
+
+    for (i = 0; i < TX_QUEUE_COUNT; i++) {
+        length += (uint8_t)(__txQueues[i]._tail - __txQueues[i]._head);
+    }
+
+    return length;
+}
+
+// Picks the next frame between frames: a queued control packet goes before
+// any queued data.
+static void LazuriteWireless_startTx()
+{
+    for (;;) {
+        TxQueue *queue = &__txQueues[TX_QUEUE_CONTROL];
+        TxRequest *request;
+        SUBGHZ_MSG ret;
+        uint8_t *data;
+        size_t size;
+        uint8_t head;
+
+        // The radio is released under the lock, so that a packet queued from
+        // an interrupt either is seen here or starts the radio itself.
+        TX_QUEUE_LOCK();
+        if (queue->_head == queue->_tail) {
+            queue = &__txQueues[TX_QUEUE_BULK];
+        }
+        if (queue->_head == queue->_tail) {
+            __txBusy = false;
+            TX_QUEUE_UNLOCK();
+            return;
+        }
+        TX_QUEUE_UNLOCK();
+
+        head = queue->_head;
+        request = &queue->_requests[head & queue->_mask];
+        __txCurrent = queue;
+        data = LazuriteWireless_getFrame(&request->_payload, &size);
+        __txData = data;
+        __txSize = size;
+        ret = SubGHz.send(request->_panid, request->_dstAddr, data, (uint16_t)size, LazuriteWireless_callback);
+        // Either the transmission is on air and the callback will move on,
+        // or the callback has already completed the request.
+        if ((ret == SUBGHZ_OK) || (head != queue->_head)) {
+            return;
+        }
+
+        DEBUG_PRINT_LONG((long)ret, DEC);
+        LazuriteWireless_completeTx(0, (uint8_t)ret);
+    }
+}
+
+static void LazuriteWireless_completeTx(uint8_t rssi, uint8_t status)
+{
+    TxQueue *queue = __txCurrent;
+    uint8_t head = queue->_head;
+    TxRequest *request = &queue->_requests[head & queue->_mask];
+
+    STATS_COUNT_TX(&request->_payload, status, request->_queued);
+    TRACE_SENT(request->_panid, request->_dstAddr, __txData, __txSize, rssi, status);
+    if (status == SUBGHZ_OK) {
+        STATS_COUNT_RSSI(rssi);
+    }
+    if (request->_callback != NULL) {
+        request->_callback((const Packet *)&request->_payload, rssi, status);
+    }
+    queue->_head = head + 1;
+}
+
+// The frames of a transfer wait for room in the queue of data, which the
+// callbacks of the frames on air make, instead of failing. Like the ACKs of
+// sendDataWithAck, this is for the main loop only.
+static void LazuriteWireless_waitTxRoom()
+{
+    TxQueue *queue = &__txQueues[TX_QUEUE_BULK];
+
+    while (!__txReserved && ((uint8_t)(queue->_tail - queue->_head) >= LAZURITE_TX_QUEUE_SIZE)) {
+        millis();
+    }
+}
+
 static size_t LazuriteWireless_sendData(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size, bool fragmented)
 {
     SUBGHZ_MSG ret;
+    Payload *payload;
     Data *idata;
 
-    Packet_initialize(__packet);
-    Packet_setType(__packet, DATA);
-    
-    if (size > LAZURITE_DATA_MAX_SIZE) {
-        fragmented = true;
+    if (fragmented || (size > LazuriteWireless_getBodyMaxSize())) {
+        return LazuriteWireless_sendFragments(panid, dstAddr, data, size);
     }
 
-    idata = (Data *)Packet_getInterface(__packet);
-    size = idata->setData(__packet, data, size);
-    idata->setFragmented(__packet, fragmented);
+    payload = LazuriteWireless_enterSend();
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return 0;
+    }
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, DATA);
+
+    idata = (Data *)Packet_getInterface((Packet *)payload);
+    size = idata->setData((Packet *)payload, data, size);
+    LazuriteWireless_compress(payload);
  
-    ret = LazuriteWireless_send(__packet, panid, dstAddr);
-    assert(ret == SUBGHZ_OK);
-    if (ret != SUBGHZ_OK) {
+    ret = LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    assert(TX_ACCEPTED(ret));
+    if (!TX_ACCEPTED(ret)) {
         size = 0;
     }
+    LazuriteWireless_leaveSend();
 
     return size;
 }
 
-static int LazuriteWireless_sendCommand(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[])
+static size_t LazuriteWireless_sendFragments(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size)
+{
+    SUBGHZ_MSG ret;
+    uint8_t transferId;
+    uint16_t index;
+    uint16_t count;
+    size_t sent = 0;
+    Payload *payload;
+
+    if (size > LAZURITE_TRANSFER_MAX_SIZE) {
+        DEBUG_PRINT("The data is too large to send.");
+        return 0;
+    }
+
+    payload = LazuriteWireless_enterSend();
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return 0;
+    }
+    count = (uint16_t)((size + LAZURITE_FRAGMENT_DATA_MAX_SIZE - 1) / LAZURITE_FRAGMENT_DATA_MAX_SIZE);
+    transferId = __transferId++;
+
+    for (index = 0; (index == 0) || (sent < size); index++) {
+        LazuriteWireless_waitTxRoom();
+        ret = LazuriteWireless_sendFragment(payload, panid, dstAddr, transferId, data, size, index, false, false);
+        assert(TX_ACCEPTED(ret));
+        if (!TX_ACCEPTED(ret)) {
+            break;
+        }
+        sent += Data_getDataSize((Packet *)payload);
+        if (LazuriteWireless_isParityDue(index, count)) {
+            LazuriteWireless_waitTxRoom();
+            LazuriteWireless_sendParity(payload, panid, dstAddr, transferId, data, size, index, count, false);
+        }
+        if (index == LAZURITE_FRAGMENT_MAX_COUNT - 1) {
+            break;
+        }
+    }
+    LazuriteWireless_leaveSend();
+
+    return sent;
+}
+
+static size_t LazuriteWireless_sendDataWithAck(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size)
+{
+    Payload *payload = LazuriteWireless_enterSend();
+
+    if (payload != NULL) {
+        size = LazuriteWireless_transferWithAck(payload, panid, dstAddr, data, size);
+    } else {
+        size = 0;
+    }
+    LazuriteWireless_leaveSend();
+
+    return size;
+}
+
+static size_t LazuriteWireless_transferWithAck(Payload * const payload, uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size)
+{
+    uint8_t acked[LAZURITE_FRAGMENT_ACK_BITMAP_SIZE];
+    uint8_t transferId;
+    uint16_t count;
+    uint16_t base = 0;
+    uint16_t sent = 0;
+    uint8_t retry = 0;
+    bool probe = false;
+
+    if (size > LAZURITE_TRANSFER_MAX_SIZE) {
+        DEBUG_PRINT("The data is too large to send.");
+        return 0;
+    }
+
+    count = (uint16_t)((size + LAZURITE_FRAGMENT_DATA_MAX_SIZE - 1) / LAZURITE_FRAGMENT_DATA_MAX_SIZE);
+    if (count == 0) {
+        count = 1;
+    }
+    transferId = __transferId++;
+    memset(acked, 0, sizeof(acked));
+
+    while (base < count) {
+        uint16_t end = base + LAZURITE_FRAGMENT_WINDOW_SIZE;
+        uint16_t last = base;
+        uint16_t index;
+        uint16_t ackBase;
+        uint8_t bitmap[LAZURITE_FRAGMENT_ACK_BITMAP_SIZE];
+        bool completed;
+        bool progress;
+
+        if (end > count) {
+            end = count;
+        }
+        for (index = base; index < end; index++) {
+            if (!Bitmap_test(acked, index - base)) {
+                last = index;
+            }
+        }
+
+        // Send every fragment in the window which has not been acknowledged
+        // yet, and request a bitmap ACK with the last one. After a timeout
+        // only the last fragment is sent again to probe for the lost ACK.
+        for (index = probe ? last : base; index <= last; index++) {
+            SUBGHZ_MSG ret;
+            bool parity;
+            if (Bitmap_test(acked, index - base)) {
+                continue;
+            }
+            // The parity of a group follows its first transmission, and asks
+            // for the ACK itself so that the receiver can use it first.
+            parity = (index >= sent) && LazuriteWireless_isParityDue(index, count);
+            if (index < sent) {
+                STATS_COUNT_RETRY();
+            }
+            LazuriteWireless_waitTxRoom();
+            ret = LazuriteWireless_sendFragment(payload, panid, dstAddr, transferId, data, size, index, (index == last) && !parity, index < sent);
+            if (!TX_ACCEPTED(ret)) {
+                DEBUG_PRINT_LONG((long)ret, DEC);
+            }
+            if (parity) {
+                LazuriteWireless_waitTxRoom();
+                ret = LazuriteWireless_sendParity(payload, panid, dstAddr, transferId, data, size, index, count, index == last);
+                if (!TX_ACCEPTED(ret)) {
+                    DEBUG_PRINT_LONG((long)ret, DEC);
+                }
+            }
+            if (index >= sent) {
+                sent = index + 1;
+            }
+        }
+
+        if (LazuriteWireless_waitFragmentAck(transferId, &ackBase, bitmap, &completed) != 0) {
+            probe = true;
+            if (++retry > LAZURITE_FRAGMENT_MAX_RETRY) {
+                DEBUG_PRINT("Sending fragments failed.");
+                return 0;
+            }
+            continue;
+        }
+        if (completed) {
+            return size;
+        }
+
+        probe = false;
+        progress = false;
+        if (ackBase < base) {
+            continue;
+        }
+        if (ackBase > base) {
+            Bitmap_shift(acked, sizeof(acked), ackBase - base);
+            base = ackBase;
+            progress = true;
+        }
+        for (index = 0; index < sizeof(bitmap); index++) {
+            if (bitmap[index] & ~acked[index]) {
+                progress = true;
+            }
+            acked[index] |= bitmap[index];
+        }
+        if (progress) {
+            retry = 0;
+        } else if (++retry > LAZURITE_FRAGMENT_MAX_RETRY) {
+            DEBUG_PRINT("Sending fragments failed.");
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+static SUBGHZ_MSG LazuriteWireless_sendFragment(Payload * const payload, uint16_t panid, uint16_t dstAddr, uint8_t transferId, const uint8_t data[], size_t size, uint16_t index, bool requested, bool retry)
+{
+    size_t offset = (size_t)index * LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+    size_t length = size - offset;
+    bool last = true;
+    uint8_t *dst;
+
+    if (length > LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+        length = LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+        last = false;
+    }
+    if (index == LAZURITE_FRAGMENT_MAX_COUNT - 1) {
+        last = true;
+    }
+
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, DATA);
+    Payload_setFragmented(payload, true);
+    Payload_setResponseRequested(payload, requested);
+    Payload_setFragmentHeader(payload, transferId, index, last);
+    // The first fragment of a transfer is marked only when it is sent for the
+    // first time, so that the receiver can tell a new transfer of a rebooted
+    // sender, with the same transfer id, from a retry of the previous one.
+    if ((index == 0) && !retry) {
+        payload->_payload[LAZURITE_PACKET_FLAG_I] |= LAZURITE_PACKET_FLAG_MASK_START;
+    }
+
+    dst = Payload_getBodyArray(payload);
+    memcpy(&dst[LAZURITE_FRAGMENT_DATA_I], &data[offset], length);
+    Payload_resetLength(payload, LAZURITE_FRAGMENT_HEADER_SIZE + length);
+
+    return LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+}
+
+// A parity fragment follows every group of __fecGroupSize fragments, and the
+// last group of a transfer. Only the first LAZURITE_FEC_GROUP_MAX_COUNT groups
+// can be numbered.
+static bool LazuriteWireless_isParityDue(uint16_t index, uint16_t count)
+{
+    if ((__fecGroupSize == 0) || (count < 2) || (index / __fecGroupSize >= LAZURITE_FEC_GROUP_MAX_COUNT)) {
+        return false;
+    }
+
+    return (((index + 1) % __fecGroupSize) == 0) || (index + 1 == count);
+}
+
+// The body of a parity fragment is the XOR of the fragments of its group,
+// padded with zeros. Its index field holds the group number and the group
+// size instead of a fragment index.
+static SUBGHZ_MSG LazuriteWireless_sendParity(Payload * const payload, uint16_t panid, uint16_t dstAddr, uint8_t transferId, const uint8_t data[], size_t size, uint16_t index, uint16_t count, bool requested)
+{
+    uint16_t group = index / __fecGroupSize;
+    size_t offset = (size_t)group * __fecGroupSize * LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+    size_t end = (size_t)(index + 1) * LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+    size_t length;
+    uint8_t *body;
+    uint8_t *parity;
+
+    if (end > size) {
+        end = size;
+    }
+    length = end - offset;
+    if (length > LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+        length = LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+    }
+
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, DATA);
+    Payload_setFragmented(payload, true);
+    Payload_setResponseRequested(payload, requested);
+    Payload_setFragmentHeader(payload, transferId,
+                              (uint16_t)((group << LAZURITE_FEC_GROUP_SHIFT) | (__fecGroupSize - 1)), index + 1 == count);
+
+    body = Payload_getBodyArray(payload);
+    body[LAZURITE_FRAGMENT_HEADER_I] |= (uint8_t)(LAZURITE_FRAGMENT_FLAG_MASK_FEC >> 8);
+    parity = &body[LAZURITE_FRAGMENT_DATA_I];
+    memset(parity, 0, length);
+    for (; offset < end; offset += LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+        size_t i;
+        size_t n = end - offset;
+
+        if (n > LAZURITE_FRAGMENT_DATA_MAX_SIZE) {
+            n = LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+        }
+        for (i = 0; i < n; i++) {
+            parity[i] ^= data[offset + i];
+        }
+    }
+    Payload_resetLength(payload, LAZURITE_FRAGMENT_HEADER_SIZE + length);
+
+    return LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+}
+
+static int LazuriteWireless_sendFragmentAck(uint16_t panid, uint16_t dstAddr, Reassembler * const reassembler)
 {
     SUBGHZ_MSG ret;
-    Command *icommand;
+    uint8_t *body;
+    bool completed = reassembler->_done;
+    Payload *payload = LazuriteWireless_enterSend();
+
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return SUBGHZ_TX_FAIL;
+    }
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, ACK);
+    Payload_setFragmented(payload, true);
+    Payload_setFragmentHeader(payload, reassembler->_transferId, reassembler->_base, completed);
+
+    body = Payload_getBodyArray(payload);
+    memcpy(&body[LAZURITE_FRAGMENT_ACK_BITMAP_I], reassembler->_window, LAZURITE_FRAGMENT_ACK_BITMAP_SIZE);
+    Payload_resetLength(payload, LAZURITE_FRAGMENT_HEADER_SIZE + LAZURITE_FRAGMENT_ACK_BITMAP_SIZE);
+    reassembler->_ackRequested = false;
+
+    ret = LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    assert(TX_ACCEPTED(ret));
+    LazuriteWireless_leaveSend();
+
+    return ret;
+}
+
+static int LazuriteWireless_waitFragmentAck(uint8_t transferId, uint16_t *base, uint8_t bitmap[], bool *completed)
+{
+    Payload * const response = &__response;
+    uint32_t start = millis();
+
+    while ((millis() - start) < LAZURITE_FRAGMENT_ACK_TIMEOUT) {
+        uint16_t header;
+
+        if (LazuriteWireless_receive((Packet *)response) != 0) {
+            continue;
+        }
+        if ((Payload_getPacketType(response) != ACK) || !Payload_isFragmented(response)) {
+            LazuriteWireless_hold(response);
+            continue;
+        }
+        if (Payload_getLength(response) < LAZURITE_FRAGMENT_HEADER_SIZE + LAZURITE_FRAGMENT_ACK_BITMAP_SIZE) {
+            continue;
+        }
+        header = Payload_getFragmentHeader(response);
+        if (((header & LAZURITE_FRAGMENT_XFER_MASK) >> LAZURITE_FRAGMENT_XFER_SHIFT) != (transferId & (LAZURITE_FRAGMENT_XFER_MASK >> LAZURITE_FRAGMENT_XFER_SHIFT))) {
+            continue;
+        }
+
+        *base = header & LAZURITE_FRAGMENT_INDEX_MASK;
+        *completed = (header & LAZURITE_FRAGMENT_FLAG_MASK_LAST) ? true : false;
+        memcpy(bitmap, &Payload_getBodyArray(response)[LAZURITE_FRAGMENT_ACK_BITMAP_I], LAZURITE_FRAGMENT_ACK_BITMAP_SIZE);
+        return 0;
+    }
+
+    return -1;
+}
+
+static uint8_t* LazuriteWireless_reserveData(bool fragmented, size_t *capacity)
+{
+    Data *idata;
 
     Packet_initialize(__packet);
-    Packet_setType(__packet, COMMAND);
+    Packet_setType(__packet, DATA);
+
+    idata = (Data *)Packet_getInterface(__packet);
+    idata->setFragmented(__packet, fragmented);
+    if (capacity != NULL) {
+        *capacity = Data_getDataMaxSize(__packet);
+    }
+
+    return idata->getDataArray(__packet);
+}
+
+static size_t LazuriteWireless_commitData(uint16_t panid, uint16_t dstAddr, size_t size, bool last)
+{
+    SUBGHZ_MSG ret;
+    Data *idata = (Data *)Packet_getInterface(__packet);
+
+    assert(Payload_getPacketType((Payload *)__packet) == DATA);
+    if (idata->resetDataSize(__packet, size) != 0) {
+        return 0;
+    }
 
-    icommand = (Command *)Packet_getInterface(__packet);
-    icommand->setCommand(__packet, cmd);
-    icommand->setCommandParam(__packet, param);
+    if (idata->isFragmented(__packet)) {
+        LazuriteWireless_setStreamHeader((Payload *)__packet, last);
+    }
 
+    LazuriteWireless_waitTxRoom();
     ret = LazuriteWireless_send(__packet, panid, dstAddr);
-    assert(ret == SUBGHZ_OK);
+    assert(TX_ACCEPTED(ret));
+    if (!TX_ACCEPTED(ret)) {
+        size = 0;
+    }
 
-    return ret;
+    return size;
+}
+
+// The packet is built in place in the next free entry of the transmit queue,
+// so one fragment can be filled while the one before is on air.
+static uint8_t* LazuriteWireless_reserveDataAsync(bool fragmented, size_t *capacity)
+{
+    TxQueue *queue = &__txQueues[TX_QUEUE_BULK];
+    uint8_t tail;
+    Payload *payload;
+
+    // Hold the entry under the lock, as sendAsync claims one, so that
+    // sendAsync from an interrupt does not take it.
+    TX_QUEUE_LOCK();
+    tail = queue->_tail;
+    if ((uint8_t)(tail - queue->_head) >= LAZURITE_TX_QUEUE_SIZE) {
+        TX_QUEUE_UNLOCK();
+        return NULL;
+    }
+    __txReserved = true;
+    TX_QUEUE_UNLOCK();
+
+    payload = &__txBulk[tail & LAZURITE_TX_QUEUE_MASK]._payload;
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, DATA);
+    Payload_setFragmented(payload, fragmented);
+    if (capacity != NULL) {
+        *capacity = Data_getDataMaxSize((Packet *)payload);
+    }
+
+    return Data_getDataArray((Packet *)payload);
+}
+
+static int LazuriteWireless_commitDataAsync(uint16_t panid, uint16_t dstAddr, size_t size, bool last, SendCallback callback)
+{
+    TxQueue *queue = &__txQueues[TX_QUEUE_BULK];
+    uint8_t tail = queue->_tail;
+    Payload *payload = &__txBulk[tail & LAZURITE_TX_QUEUE_MASK]._payload;
+    bool start;
+
+    assert(Payload_getPacketType(payload) == DATA);
+    if (!__txReserved || ((uint8_t)(tail - queue->_head) >= LAZURITE_TX_QUEUE_SIZE)) {
+        return -1;
+    }
+    if (Data_resetDataSize((Packet *)payload, size) != 0) {
+        return -1;
+    }
+
+    if (Payload_isFragmented(payload)) {
+        LazuriteWireless_setStreamHeader(payload, last);
+    }
+    TX_QUEUE_LOCK();
+    __txReserved = false;
+    start = LazuriteWireless_enqueueTx(queue, panid, dstAddr, callback);
+    TX_QUEUE_UNLOCK();
+
+    if (start) {
+        LazuriteWireless_startTx();
+    }
+
+    return 0;
+}
+
+// Releases the entry of reserveDataAsync and ends the stream. The receiver
+// drops the unfinished transfer when the next one starts.
+static void LazuriteWireless_cancelDataAsync()
+{
+    TX_QUEUE_LOCK();
+    __txReserved = false;
+    TX_QUEUE_UNLOCK();
+    __streamIndex = 0;
+}
+
+static void LazuriteWireless_setStreamHeader(Payload * const payload, bool last)
+{
+    if (__streamIndex == 0) {
+        __streamTransferId = __transferId++;
+    }
+    if (__streamIndex == LAZURITE_FRAGMENT_MAX_COUNT - 1) {
+        last = true;
+    }
+    Payload_setFragmentHeader(payload, __streamTransferId, __streamIndex, last);
+    if (__streamIndex == 0) {
+        payload->_payload[LAZURITE_PACKET_FLAG_I] |= LAZURITE_PACKET_FLAG_MASK_START;
+    }
+    __streamIndex = last ? 0 : __streamIndex + 1;
+}
+
+static int LazuriteWireless_sendCommand(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[])
+{
+    return LazuriteWireless_sendBinaryCommand(panid, dstAddr, cmd, (const uint8_t *)param, strlen(param), false);
 }
 
 static int LazuriteWireless_sendCommandWithAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[])
+{
+    return LazuriteWireless_sendBinaryCommand(panid, dstAddr, cmd, (const uint8_t *)param, strlen(param), true);
+}
+
+static int LazuriteWireless_sendAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char response[])
+{
+    return LazuriteWireless_sendBinaryAck(panid, dstAddr, cmd, (const uint8_t *)response, strlen(response));
+}
+
+static int LazuriteWireless_sendBinaryCommand(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t param[], size_t length, bool ackRequested)
 {
     SUBGHZ_MSG ret;
-    Command *icommand;
+    Payload *payload = LazuriteWireless_enterSend();
 
-    Packet_initialize(__packet);
-    Packet_setType(__packet, COMMAND);
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return SUBGHZ_TX_FAIL;
+    }
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, COMMAND);
 
-    icommand = (Command *)Packet_getInterface(__packet);
-    icommand->setCommand(__packet, cmd);
-    icommand->setCommandParam(__packet, param);
-    icommand->enableAckRequest(__packet);
+    Command_setCommand((Packet *)payload, cmd);
+    Command_setCommandParamBytes((Packet *)payload, param, length);
+    Command_setResponseRequested((Packet *)payload, ackRequested);
+    LazuriteWireless_fitBody(payload);
 
-    ret = LazuriteWireless_send(__packet, panid, dstAddr);
-    assert(ret == SUBGHZ_OK);
+    ret = LazuriteWireless_aggregate(payload, panid, dstAddr);
+    assert(TX_ACCEPTED(ret));
+    LazuriteWireless_leaveSend();
 
     return ret;
 }
 
-static int LazuriteWireless_sendAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char response[])
+static int LazuriteWireless_sendBinaryAck(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t response[], size_t length)
 {
     SUBGHZ_MSG ret;
-    Ack *iack;
+    Payload *payload = LazuriteWireless_enterSend();
 
-    Packet_initialize(__packet);
-    Packet_setType(__packet, ACK);
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return SUBGHZ_TX_FAIL;
+    }
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, ACK);
 
-    iack = (Ack *)Packet_getInterface(__packet);
-    iack->setCommand(__packet, cmd);
-    iack->setResponse(__packet, response);
+    Ack_setCommand((Packet *)payload, cmd);
+    Ack_setResponseBytes((Packet *)payload, response, length);
+    LazuriteWireless_fitBody(payload);
 
-    ret = LazuriteWireless_send(__packet, panid, dstAddr);
-    assert(ret == SUBGHZ_OK);
+    ret = LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    assert(TX_ACCEPTED(ret));
+    LazuriteWireless_leaveSend();
 
     return ret;
 }
@@ -271,16 +1374,28 @@ static int LazuriteWireless_sendAck(uint16_t panid, uint16_t dstAddr, uint8_t cm
 static int LazuriteWireless_sendNotice(uint16_t panid, uint16_t dstAddr, const char notice[])
 {
     SUBGHZ_MSG ret;
+    Payload *payload = LazuriteWireless_enterSend();
     Notice *inotice;
 
-    Packet_initialize(__packet);
-    Packet_setType(__packet, NOTICE);
+    if (payload == NULL) {
+        LazuriteWireless_leaveSend();
+        return SUBGHZ_TX_FAIL;
+    }
+    Packet_initialize((Packet *)payload);
+    Packet_setType((Packet *)payload, NOTICE);
 
-    inotice = (Notice *)Packet_getInterface(__packet);
-    inotice->setNotice(__packet, notice);
+    inotice = (Notice *)Packet_getInterface((Packet *)payload);
+    inotice->setNotice((Packet *)payload, notice);
+    LazuriteWireless_fitBody(payload);
 
-    ret = LazuriteWireless_send(__packet, panid, dstAddr);
-    assert(ret == SUBGHZ_OK);
+    if (__aggregation) {
+        ret = LazuriteWireless_aggregate(payload, panid, dstAddr);
+    } else {
+        LazuriteWireless_compress(payload);
+        ret = LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    }
+    assert(TX_ACCEPTED(ret));
+    LazuriteWireless_leaveSend();
 
     return ret;
 }
@@ -301,10 +1416,53 @@ static SUBGHZ_MSG LazuriteWireless_disableRx()
 
     ret = SubGHz.rxDisable();
     assert(ret == SUBGHZ_OK);
+    __rxRingEnabled = false;
 
     return ret;
 }
 
+static SUBGHZ_MSG LazuriteWireless_enableRxRing()
+{
+    SUBGHZ_MSG ret;
+
+    __rxTail = __rxHead;
+    __rxRingEnabled = true;
+
+    ret = SubGHz.rxEnable(LazuriteWireless_rxCallback);
+    assert(ret == SUBGHZ_OK);
+
+    return ret;
+}
+
+static void LazuriteWireless_rxCallback(const uint8_t *data, uint8_t rssi, int status)
+{
+    uint8_t head = __rxHead;
+
+    // The frame is read with SubGHz.readData like in listen().
+    (void)data;
+    (void)status;
+
+    STATS_COUNT_RSSI(rssi);
+
+    if ((uint8_t)(head - __rxTail) >= LAZURITE_RX_RING_SIZE) {
+        // The ring is full. The frame still has to be read out of the
+        // driver, so it is dropped into a scratch buffer. It is neither
+        // counted as received nor entered in the duplicate cache, so that
+        // a retry of it is not dropped as well.
+        short size = SubGHz.readData(__rxDiscard._payload, LAZURITE_PAYLOAD_SIZE);
+
+        if (size >= LAZURITE_PACKET_HEADER_SIZE) {
+            TRACE_RECEIVED(__rxDiscard._payload, (size_t)size, rssi);
+        }
+        __rxOverflow++;
+        return;
+    }
+
+    if (LazuriteWireless_readPayload(&__rxRing[head & LAZURITE_RX_RING_MASK], rssi) == 0) {
+        __rxHead = head + 1;
+    }
+}
+
 static uint8_t LazuriteWireless_getAddrType()
 {
     SUBGHZ_MSG ret;
@@ -381,13 +1539,636 @@ static SUBGHZ_MSG LazuriteWireless_setSendMode(uint8_t addrType, uint8_t txRetry
     ret = SubGHz.setSendMode(&param);
     assert(ret == SUBGHZ_OK);
 
-    return ret;
+    return ret;
+}
+
+static void LazuriteWireless_callback(uint8_t rssi, uint8_t status)
+{
+    if (__txCurrent->_head == __txCurrent->_tail) {
+        return;
+    }
+
+    LazuriteWireless_completeTx(rssi, status);
+    LazuriteWireless_startTx();
+}
+
+static void LazuriteWireless_setCompression(bool on)
+{
+    __compression = on;
+}
+
+static uint8_t LazuriteWireless_getCompressionRatio()
+{
+    if (__compressionIn == 0) {
+        return 100;
+    }
+    return (uint8_t)((__compressionOut * 100 + __compressionIn - 1) / __compressionIn);
+}
+
+static void LazuriteWireless_compress(Payload * const payload)
+{
+    uint8_t *body = Payload_getBodyArray(payload);
+    size_t length = Payload_getLength(payload);
+    size_t size = 0;
+
+    // A packet sent from an interrupt handler while the scratch buffer is
+    // in use goes out as it is.
+    if (!__compression || __scratchBusy) {
+        return;
+    }
+    __scratchBusy = true;
+
+    if (length > LZSS_MIN_MATCH) {
+        size = Lzss_compress(body, length, __scratch, length - 1);
+    }
+    __compressionIn += length;
+    if (size == 0) {
+        // It did not get any smaller, so the packet goes out as it is.
+        __compressionOut += length;
+        __scratchBusy = false;
+        return;
+    }
+    __compressionOut += size;
+
+    memcpy(body, __scratch, size);
+    __scratchBusy = false;
+    Payload_resetLength(payload, size);
+    Payload_setCompressed(payload, true);
+}
+
+static int LazuriteWireless_expand(Payload * const payload)
+{
+    uint8_t *body = Payload_getBodyArray(payload);
+    size_t length = Payload_getLength(payload);
+    int size;
+
+    if (!Payload_isCompressed(payload)) {
+        return 0;
+    }
+
+    __scratchBusy = true;
+    memcpy(__scratch, body, length);
+    size = Lzss_decompress(__scratch, length, body, LAZURITE_PACKET_BODY_SIZE);
+    __scratchBusy = false;
+    if (size < 0) {
+        DEBUG_PRINT("Decompressing a packet failed.");
+        return -1;
+    }
+
+    body[size] = 0;
+    Payload_resetLength(payload, (size_t)size);
+    Payload_setCompressed(payload, false);
+
+    return 0;
+}
+
+static void LazuriteWireless_setAggregation(bool on, uint16_t deadline)
+{
+    if (!on) {
+        LazuriteWireless_flush();
+    }
+    __aggregation = on;
+    __aggregateDeadline = deadline;
+}
+
+static void LazuriteWireless_setFec(uint8_t groupSize)
+{
+    assert(groupSize <= LAZURITE_FEC_GROUP_MAX_SIZE);
+    if (groupSize > LAZURITE_FEC_GROUP_MAX_SIZE) {
+        groupSize = LAZURITE_FEC_GROUP_MAX_SIZE;
+    }
+    __fecGroupSize = groupSize;
+}
+
+static void LazuriteWireless_setDuplicateFilter(bool on, uint16_t expiry)
+{
+    dis_interrupts(DI_SUBGHZ);
+    memset(__duplicates, 0, sizeof(__duplicates));
+    __duplicateFilter = on;
+    __duplicateExpiry = expiry;
+    enb_interrupts(DI_SUBGHZ);
+    __myAddress = SubGHz.getMyAddress();
+}
+
+// While the filter is on, every frame ends with the address of its sender
+// and a sequence number. The MAC sends the same frame again when its ACK is
+// lost, so the receiver sees the same pair twice.
+// Only the sender which holds the radio (__txBusy) builds a frame, so the
+// frame has one buffer. The sequence is taken under the lock anyway, so
+// that no number is given out twice. The frame is always a copy, as the
+// packet of send is const and SubGHz.send takes a writable buffer.
+static uint8_t* LazuriteWireless_getFrame(const Payload * const payload, size_t *size)
+{
+    size_t length = Payload_getPayloadLength((Payload *)payload);
+    uint8_t sequence;
+
+    assert(__txBusy);
+    memcpy(__txFrame, payload->_payload, length);
+    // A body longer than getBodyMaxSize, from a packet the application
+    // built, goes out without the trailer and bypasses the filter.
+    if (!__duplicateFilter || (length + LAZURITE_SEQUENCE_TRAILER_SIZE > LAZURITE_PAYLOAD_SIZE)) {
+        *size = length;
+        return __txFrame;
+    }
+
+    TX_QUEUE_LOCK();
+    sequence = __txSequence++;
+    TX_QUEUE_UNLOCK();
+
+    __txFrame[LAZURITE_PACKET_FLAG_I] |= LAZURITE_PACKET_FLAG_MASK_SEQ;
+    __txFrame[length] = (uint8_t)(__myAddress >> 8);
+    __txFrame[length + 1] = (uint8_t)(__myAddress & 0xff);
+    __txFrame[length + 2] = sequence;
+    *size = length + LAZURITE_SEQUENCE_TRAILER_SIZE;
+
+    return __txFrame;
+}
+
+// While the filter is on, unfragmented packets leave room for the trailer.
+// Fragments always do, as their size is fixed for the receiver.
+static size_t LazuriteWireless_getBodyMaxSize()
+{
+    return __duplicateFilter ? (LAZURITE_PACKET_BODY_SIZE - LAZURITE_SEQUENCE_TRAILER_SIZE) : LAZURITE_PACKET_BODY_SIZE;
+}
+
+// Commands, ACKs and notices are cut to getBodyMaxSize, as DATA goes out
+// fragmented, so that the frames of the send functions always carry the
+// trailer.
+static void LazuriteWireless_fitBody(Payload * const payload)
+{
+    size_t max = LazuriteWireless_getBodyMaxSize();
+
+    if (Payload_getLength(payload) > max) {
+        Payload_resetLength(payload, max);
+    }
+}
+
+// Removes the sequence trailer, keeps its sender as the source of the
+// packet, and looks the pair up in a direct-mapped cache. A pair seen
+// within the expiry time is a duplicate.
+static bool LazuriteWireless_isDuplicate(Payload * const payload)
+{
+    size_t length = Payload_getLength(payload);
+    const uint8_t *trailer;
+    DuplicateEntry *entry;
+    uint16_t srcAddr;
+    uint8_t sequence;
+    uint32_t now;
+
+    if (!(payload->_payload[LAZURITE_PACKET_FLAG_I] & LAZURITE_PACKET_FLAG_MASK_SEQ) ||
+        (length < LAZURITE_SEQUENCE_TRAILER_SIZE)) {
+        return false;
+    }
+
+    length -= LAZURITE_SEQUENCE_TRAILER_SIZE;
+    trailer = &payload->_payload[LAZURITE_PACKET_HEADER_SIZE + length];
+    srcAddr = (uint16_t)(((uint16_t)trailer[0] << 8) | trailer[1]);
+    sequence = trailer[2];
+    payload->_payload[LAZURITE_PACKET_FLAG_I] &= (uint8_t)~LAZURITE_PACKET_FLAG_MASK_SEQ;
+    payload->_payload[LAZURITE_PACKET_HEADER_SIZE + length] = 0;
+    payload->_srcAddr = srcAddr;
+    Payload_resetLength(payload, length);
+
+    if (!__duplicateFilter) {
+        return false;
+    }
+
+    entry = &__duplicates[(uint8_t)(sequence + (srcAddr ^ (srcAddr >> 8))) & LAZURITE_DUPLICATE_CACHE_MASK];
+    now = millis();
+    if (entry->_used && (entry->_srcAddr == srcAddr) && (entry->_sequence == sequence) &&
+        ((now - entry->_time) < __duplicateExpiry)) {
+        STATS_COUNT_DUPLICATE();
+        return true;
+    }
+    entry->_srcAddr = srcAddr;
+    entry->_sequence = sequence;
+    entry->_used = true;
+    entry->_time = now;
+
+    return false;
+}
+
+static SUBGHZ_MSG LazuriteWireless_aggregate(Payload * const payload, uint16_t panid, uint16_t dstAddr)
+{
+    SUBGHZ_MSG ret = SUBGHZ_OK;
+    size_t length = Payload_getLength(payload);
+    size_t used;
+    uint8_t *body;
+
+    // A handler which interrupts the aggregation leaves the frame alone.
+    if (__aggregating) {
+        return LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    }
+    if (!__aggregation || (length + LAZURITE_AGGREGATE_RECORD_SIZE > LAZURITE_PACKET_BODY_SIZE)) {
+        LazuriteWireless_flush();
+        return LazuriteWireless_send((Packet *)payload, panid, dstAddr);
+    }
+    __aggregating = true;
+
+    if ((__aggregateCount > 0) &&
+        ((panid != __aggregatePanid) || (dstAddr != __aggregateDstAddr) ||
+         (Payload_getLength(&__aggregate) + LAZURITE_AGGREGATE_RECORD_SIZE + length > LazuriteWireless_getBodyMaxSize()))) {
+        ret = LazuriteWireless_flush();
+    }
+
+    if (__aggregateCount == 0) {
+        Packet_initialize((Packet *)&__aggregate);
+        Payload_setPacketType(&__aggregate, AGGREGATE);
+        __aggregatePanid = panid;
+        __aggregateDstAddr = dstAddr;
+        __aggregateStart = millis();
+    }
+
+    used = Payload_getLength(&__aggregate);
+    body = Payload_getBodyArray(&__aggregate) + used;
+    body[LAZURITE_AGGREGATE_HEADER_I] = Payload_getPayloadArray(payload)[LAZURITE_PACKET_FLAG_I];
+    body[LAZURITE_AGGREGATE_LENGTH_I] = (uint8_t)length;
+    memcpy(&body[LAZURITE_AGGREGATE_BODY_I], Payload_getBodyArray(payload), length);
+    Payload_resetLength(&__aggregate, used + LAZURITE_AGGREGATE_RECORD_SIZE + length);
+    __aggregateCount++;
+
+    LazuriteWireless_flushIfDue();
+    __aggregating = false;
+
+    return ret;
+}
+
+static SUBGHZ_MSG LazuriteWireless_flush()
+{
+    SUBGHZ_MSG ret;
+    uint8_t count = __aggregateCount;
+    bool aggregating = __aggregating;
+
+    if (count == 0) {
+        return SUBGHZ_OK;
+    }
+    __aggregating = true;
+    __aggregateCount = 0;
+
+    if (count == 1) {
+        // A single record is sent as an ordinary packet.
+        uint8_t *record = Payload_getBodyArray(&__aggregate);
+        uint8_t header = record[LAZURITE_AGGREGATE_HEADER_I];
+        size_t length = record[LAZURITE_AGGREGATE_LENGTH_I];
+
+        memmove(record, &record[LAZURITE_AGGREGATE_BODY_I], length);
+        Payload_getPayloadArray(&__aggregate)[LAZURITE_PACKET_FLAG_I] = header;
+        Payload_resetLength(&__aggregate, length);
+        if (Payload_getPacketType(&__aggregate) == NOTICE) {
+            LazuriteWireless_compress(&__aggregate);
+        }
+    } else {
+        LazuriteWireless_compress(&__aggregate);
+    }
+
+    ret = LazuriteWireless_send((Packet *)&__aggregate, __aggregatePanid, __aggregateDstAddr);
+    assert(TX_ACCEPTED(ret));
+    __aggregating = aggregating;
+
+    return ret;
+}
+
+// There is no timer behind the deadline, as timer2 belongs to the sketch.
+// It is checked when a packet is added, and by listen and poll, so a sketch
+// which only sends calls flush itself.
+static void LazuriteWireless_flushIfDue()
+{
+    if ((__aggregateCount > 0) && (__aggregateDeadline != 0) &&
+        ((millis() - __aggregateStart) >= __aggregateDeadline)) {
+        LazuriteWireless_flush();
+    }
+}
+
+static int LazuriteWireless_split(Payload * const payload)
+{
+    memcpy(__rxAggregate._payload, payload->_payload, Payload_getPayloadLength(payload));
+    __rxAggregate._length = payload->_length;
+    __rxAggregate._srcAddr = payload->_srcAddr;
+    __rxAggregateOffset = 0;
+
+    return LazuriteWireless_unpack(payload);
+}
+
+static int LazuriteWireless_unpack(Payload * const payload)
+{
+    size_t total = Payload_getLength(&__rxAggregate);
+    const uint8_t *record;
+    size_t length;
+
+    if (__rxAggregateOffset + LAZURITE_AGGREGATE_RECORD_SIZE > total) {
+        return -1;
+    }
+
+    record = Payload_getBodyArray(&__rxAggregate) + __rxAggregateOffset;
+    length = record[LAZURITE_AGGREGATE_LENGTH_I];
+    if (__rxAggregateOffset + LAZURITE_AGGREGATE_RECORD_SIZE + length > total) {
+        DEBUG_PRINT("A broken aggregated packet is discarded.");
+        __rxAggregateOffset = total;
+        return -1;
+    }
+    __rxAggregateOffset += LAZURITE_AGGREGATE_RECORD_SIZE + length;
+
+    if (payload != NULL) {
+        uint8_t *body = Payload_getBodyArray(payload);
+        Payload_getPayloadArray(payload)[LAZURITE_PACKET_FLAG_I] = record[LAZURITE_AGGREGATE_HEADER_I];
+        memcpy(body, &record[LAZURITE_AGGREGATE_BODY_I], length);
+        body[length] = 0;
+        payload->_srcAddr = __rxAggregate._srcAddr;
+        Payload_resetLength(payload, length);
+    }
+
+    return 0;
+}
+
+// Sends from a timer interrupt are counted too.
+static void LazuriteWireless_getStats(WirelessStats *stats)
+{
+    TX_QUEUE_LOCK();
+    memcpy(stats, &__stats, sizeof(WirelessStats));
+    TX_QUEUE_UNLOCK();
+}
+
+static void LazuriteWireless_resetStats()
+{
+    TX_QUEUE_LOCK();
+    memset(&__stats, 0, sizeof(WirelessStats));
+    __stats.rssiMin = 0xff;
+    TX_QUEUE_UNLOCK();
+}
+
+static int LazuriteWireless_sendStats(uint16_t panid, uint16_t dstAddr)
+{
+    WirelessStats stats;
+    char notice[LAZURITE_NOTICE_MAX_SIZE + 1];
+    size_t pos = 0;
+    uint32_t total;
+    uint8_t i;
+
+    LazuriteWireless_getStats(&stats);
+
+    // tx=<frames>/<bytes>,rx=<frames>/<bytes>,fail=<code:count>...,retry=<n>,rec=<n>,dup=<n>,
+    // rssi=<min>/<avg>/<max>,lat=<bucket>/.../<bucket>
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "tx=");
+    for (total = 0, i = 0; i < LAZURITE_STATS_PACKET_TYPES; i++) {
+        total += stats.txFrames[i];
+    }
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, total, '/');
+    for (total = 0, i = 0; i < LAZURITE_STATS_PACKET_TYPES; i++) {
+        total += stats.txBytes[i];
+    }
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, total, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "rx=");
+    for (total = 0, i = 0; i < LAZURITE_STATS_PACKET_TYPES; i++) {
+        total += stats.rxFrames[i];
+    }
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, total, '/');
+    for (total = 0, i = 0; i < LAZURITE_STATS_PACKET_TYPES; i++) {
+        total += stats.rxBytes[i];
+    }
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, total, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "fail=");
+    for (i = 1; i < LAZURITE_STATS_FAILURE_CODES; i++) {
+        if (stats.txFailures[i] != 0) {
+            if (notice[pos - 1] != '=') {
+                pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, " ");
+            }
+            pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, i, ':');
+            pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.txFailures[i], '\0');
+        }
+    }
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, ",retry=");
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.retries, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "rec=");
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.recovered, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "dup=");
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.duplicates, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "rssi=");
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.rssiCount ? stats.rssiMin : 0, '/');
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.rssiCount ? stats.rssiSum / stats.rssiCount : 0, '/');
+    pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.rssiMax, ',');
+    pos = LazuriteWireless_formatText(notice, sizeof(notice), pos, "lat=");
+    for (i = 0; i < LAZURITE_STATS_LATENCY_BUCKETS; i++) {
+        pos = LazuriteWireless_formatNumber(notice, sizeof(notice), pos, stats.latency[i],
+                                            (i + 1 < LAZURITE_STATS_LATENCY_BUCKETS) ? '/' : '\0');
+    }
+    notice[pos] = '\0';
+
+    return LazuriteWireless_sendNotice(panid, dstAddr, notice);
+}
+
+static void LazuriteWireless_countTx(const Payload * const payload, uint8_t status, uint32_t start)
+{
+    uint8_t type = PACKET_GET_TYPE(payload);
+    uint32_t latency = millis() - start;
+    uint8_t bucket = 0;
+
+    if (type >= LAZURITE_STATS_PACKET_TYPES) {
+        type = LAZURITE_STATS_PACKET_TYPES - 1;
+    }
+    if (status != SUBGHZ_OK) {
+        if (status >= LAZURITE_STATS_FAILURE_CODES) {
+            status = LAZURITE_STATS_FAILURE_CODES - 1;
+        }
+        __stats.txFailures[status]++;
+        return;
+    }
+
+    __stats.txFrames[type]++;
+    __stats.txBytes[type] += PACKET_GET_BODY_LENGTH(payload) + LAZURITE_PACKET_HEADER_SIZE;
+    for (latency >>= 1; (latency != 0) && (bucket < LAZURITE_STATS_LATENCY_BUCKETS - 1); latency >>= 1) {
+        bucket++;
+    }
+    __stats.latency[bucket]++;
+}
+
+static void LazuriteWireless_countRx(const Payload * const payload)
+{
+    uint8_t type = PACKET_GET_TYPE(payload);
+
+    if (type >= LAZURITE_STATS_PACKET_TYPES) {
+        type = LAZURITE_STATS_PACKET_TYPES - 1;
+    }
+    __stats.rxFrames[type]++;
+    __stats.rxBytes[type] += PACKET_GET_BODY_LENGTH(payload) + LAZURITE_PACKET_HEADER_SIZE;
+}
+
+static void LazuriteWireless_countRssi(uint8_t rssi)
+{
+    if (rssi < __stats.rssiMin) {
+        __stats.rssiMin = rssi;
+    }
+    if (rssi > __stats.rssiMax) {
+        __stats.rssiMax = rssi;
+    }
+    __stats.rssiSum += rssi;
+    __stats.rssiCount++;
+}
+
+static size_t LazuriteWireless_formatNumber(char buffer[], size_t size, size_t pos, uint32_t number, char separator)
+{
+    char digits[10];
+    uint8_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + (number % 10));
+        number /= 10;
+    } while (number != 0);
+
+    // Keep room for the separator and the terminator.
+    while ((count > 0) && (pos + 2 < size)) {
+        buffer[pos++] = digits[--count];
+    }
+    if ((separator != '\0') && (pos + 1 < size)) {
+        buffer[pos++] = separator;
+    }
+
+    return pos;
+}
+
+static size_t LazuriteWireless_formatText(char buffer[], size_t size, size_t pos, const char *text)
+{
+    while ((*text != '\0') && (pos + 1 < size)) {
+        buffer[pos++] = *text++;
+    }
+
+    return pos;
+}
+
+static void LazuriteWireless_setTrace(bool on)
+{
+#if LAZURITE_TRACE_SIZE > 0
+    __traceEnabled = on;
+#endif /* LAZURITE_TRACE_SIZE */
+}
+
+// Copies the last events, oldest first.
+static size_t LazuriteWireless_getTrace(TraceEvent events[], size_t count)
+{
+#if LAZURITE_TRACE_SIZE > 0
+    uint8_t first;
+    size_t i;
+
+    // Sends from a timer interrupt are traced too.
+    TX_QUEUE_LOCK();
+    if (count > __traceCount) {
+        count = __traceCount;
+    }
+    first = (uint8_t)(__traceHead - count);
+    for (i = 0; i < count; i++) {
+        memcpy(&events[i], &__trace[(uint8_t)(first + i) & LAZURITE_TRACE_MASK], sizeof(TraceEvent));
+    }
+    TX_QUEUE_UNLOCK();
+
+    return count;
+#else
+    return 0;
+#endif /* LAZURITE_TRACE_SIZE */
+}
+
+// Writes the trace to Serial in the format read by extras/trace2pcap.
+// Recording stops while it is written, so that the dump is one snapshot.
+static size_t LazuriteWireless_dumpTrace()
+{
+#if LAZURITE_TRACE_SIZE > 0
+    uint8_t record[LAZURITE_TRACE_RECORD_SIZE];
+    TraceEvent event;
+    bool enabled = __traceEnabled;
+    size_t written;
+    size_t count;
+    size_t i;
+
+    __traceEnabled = false;
+    count = __traceCount;
+
+    memcpy(record, LAZURITE_TRACE_MAGIC, 4);
+    record[4] = LAZURITE_TRACE_VERSION;
+    record[5] = LAZURITE_TRACE_BODY_SIZE;
+    record[6] = (uint8_t)(count & 0xff);
+    record[7] = (uint8_t)(count >> 8);
+    written = Serial.write(record, LAZURITE_TRACE_HEADER_SIZE);
+
+    for (i = 0; i < count; i++) {
+        memcpy(&event, &__trace[(uint8_t)(__traceHead - count + i) & LAZURITE_TRACE_MASK], sizeof(TraceEvent));
+        record[0] = (uint8_t)(event.time & 0xff);
+        record[1] = (uint8_t)((event.time >> 8) & 0xff);
+        record[2] = (uint8_t)((event.time >> 16) & 0xff);
+        record[3] = (uint8_t)(event.time >> 24);
+        record[4] = (uint8_t)(event.panid & 0xff);
+        record[5] = (uint8_t)(event.panid >> 8);
+        record[6] = (uint8_t)(event.srcAddr & 0xff);
+        record[7] = (uint8_t)(event.srcAddr >> 8);
+        record[8] = (uint8_t)(event.dstAddr & 0xff);
+        record[9] = (uint8_t)(event.dstAddr >> 8);
+        record[10] = event.direction;
+        record[11] = event.rssi;
+        record[12] = event.status;
+        record[13] = event.header;
+        record[14] = event.length;
+        memcpy(&record[15], event.body, LAZURITE_TRACE_BODY_SIZE);
+        written += Serial.write(record, LAZURITE_TRACE_RECORD_SIZE);
+    }
+    Serial.flush();
+
+    __traceEnabled = enabled;
+
+    return written;
+#else
+    return 0;
+#endif /* LAZURITE_TRACE_SIZE */
+}
+
+#if LAZURITE_TRACE_SIZE > 0
+// Records one frame. It runs for every frame sent and received, also in the
+// receive interrupt, so it only copies.
+static void LazuriteWireless_trace(TraceDirection direction, uint16_t panid, uint16_t srcAddr, uint16_t dstAddr, const uint8_t frame[], size_t size, uint8_t rssi, uint8_t status)
+{
+    TraceEvent *event;
+    size_t length;
+    uint8_t head;
+
+    if (!__traceEnabled || (size < LAZURITE_PACKET_HEADER_SIZE)) {
+        return;
+    }
+
+    // The timestamp is taken with the slot, so that the events stay in
+    // time order even when an interrupt traces in between.
+    TX_QUEUE_LOCK();
+    head = __traceHead++;
+    if (__traceCount < LAZURITE_TRACE_SIZE) {
+        __traceCount++;
+    }
+    event = &__trace[head & LAZURITE_TRACE_MASK];
+    event->time = micros();
+    TX_QUEUE_UNLOCK();
+
+    event->panid = panid;
+    event->srcAddr = srcAddr;
+    event->dstAddr = dstAddr;
+    event->direction = (uint8_t)direction;
+    event->rssi = rssi;
+    event->status = status;
+    event->header = frame[LAZURITE_PACKET_FLAG_I];
+    event->length = (uint8_t)size;
+    length = size - LAZURITE_PACKET_HEADER_SIZE;
+    if (length > LAZURITE_TRACE_BODY_SIZE) {
+        length = LAZURITE_TRACE_BODY_SIZE;
+    }
+    memcpy(event->body, &frame[LAZURITE_PACKET_HEADER_SIZE], length);
 }
 
-static void LazuriteWireless_callback(uint8_t rssi, uint8_t status)
+// The driver does not pass on the source address, only the sequence
+// trailer of the duplicate filter carries it.
+static void LazuriteWireless_traceRx(const uint8_t frame[], size_t size, uint8_t rssi)
 {
-    Serial.println("Sending a packet is complete.");
+    uint16_t srcAddr = LAZURITE_ADDRESS_UNKNOWN;
+
+    if ((frame[LAZURITE_PACKET_FLAG_I] & LAZURITE_PACKET_FLAG_MASK_SEQ) &&
+        (size >= LAZURITE_PACKET_HEADER_SIZE + LAZURITE_SEQUENCE_TRAILER_SIZE)) {
+        srcAddr = (uint16_t)(((uint16_t)frame[size - 3] << 8) | frame[size - 2]);
+    }
+    LazuriteWireless_trace(TRACE_RX, __panid, srcAddr, __myAddress, frame, size, rssi, 0);
 }
+#endif /* LAZURITE_TRACE_SIZE */
 
 static uint8_t* Payload_getBodyArray(Payload * const self)
 {
@@ -420,6 +2201,11 @@ static bool Payload_isFragmented(const Payload * const self)
     return (self->_payload[LAZURITE_PACKET_FLAG_I] & LAZURITE_PACKET_FLAG_MASK_FRAG) ? true : false;
 }
 
+static bool Payload_isCompressed(const Payload * const self)
+{
+    return PACKET_IS_COMPRESSED(self);
+}
+
 static bool Payload_isResponseRequested(Payload * const self)
 {
     return (self->_payload[LAZURITE_PACKET_FLAG_I] & LAZURITE_PACKET_FLAG_MASK_ACK) ? true : false;
@@ -441,6 +2227,32 @@ static void Payload_setResponseRequested(Payload * const self, bool requested)
         self->_payload[LAZURITE_PACKET_FLAG_I] &= ~LAZURITE_PACKET_FLAG_MASK_ACK;
 }
 
+static uint16_t Payload_getFragmentHeader(const Payload * const self)
+{
+    return DATA_GET_FRAGMENT_HEADER(self);
+}
+
+static void Payload_setFragmentHeader(Payload * const self, uint8_t transferId, uint16_t index, bool last)
+{
+    uint8_t *header = &self->_payload[LAZURITE_PACKET_HEADER_SIZE + LAZURITE_FRAGMENT_HEADER_I];
+    uint16_t value = index & LAZURITE_FRAGMENT_INDEX_MASK;
+
+    value |= ((uint16_t)transferId << LAZURITE_FRAGMENT_XFER_SHIFT) & LAZURITE_FRAGMENT_XFER_MASK;
+    if (last) {
+        value |= LAZURITE_FRAGMENT_FLAG_MASK_LAST;
+    }
+    header[0] = (uint8_t)(value >> 8);
+    header[1] = (uint8_t)(value & 0xff);
+}
+
+static void Payload_setCompressed(Payload * const self, bool compressed)
+{
+    if (compressed)
+        self->_payload[LAZURITE_PACKET_FLAG_I] |= LAZURITE_PACKET_FLAG_MASK_COMP;
+    else
+        self->_payload[LAZURITE_PACKET_FLAG_I] &= ~LAZURITE_PACKET_FLAG_MASK_COMP;
+}
+
 static void Payload_setPacketType(Payload * const self, PacketType type)
 {
     self->_payload[LAZURITE_PACKET_TYPE_I] &= ~LAZURITE_PACKET_TYPE_MASK;
@@ -464,19 +2276,254 @@ static void Payload_resetLength(Payload * const self, size_t length)
 }
 
 
+static bool Bitmap_test(const uint8_t bitmap[], uint16_t i)
+{
+    return (bitmap[i >> 3] & (1 << (i & 0x07))) ? true : false;
+}
+
+static void Bitmap_set(uint8_t bitmap[], uint16_t i)
+{
+    bitmap[i >> 3] |= (uint8_t)(1 << (i & 0x07));
+}
+
+static void Bitmap_shift(uint8_t bitmap[], size_t size, uint16_t count)
+{
+    size_t i;
+
+    for (; count >= 8; count -= 8) {
+        for (i = 0; i < size - 1; i++) {
+            bitmap[i] = bitmap[i + 1];
+        }
+        bitmap[size - 1] = 0;
+    }
+    if (count == 0) {
+        return;
+    }
+    for (i = 0; i < size; i++) {
+        bitmap[i] >>= count;
+        if (i + 1 < size) {
+            bitmap[i] |= (uint8_t)(bitmap[i + 1] << (8 - count));
+        }
+    }
+}
+
+static size_t Lzss_compress(const uint8_t src[], size_t size, uint8_t dst[], size_t capacity)
+{
+    uint8_t table[LZSS_HASH_SIZE];
+    size_t in = 0;
+    size_t out = 0;
+    size_t control = 0;
+    uint8_t bit = 0;
+
+    memset(table, LZSS_EMPTY, sizeof(table));
+
+    while (in < size) {
+        size_t length = 0;
+        size_t offset = 0;
+
+        if (bit == 0) {
+            if (out >= capacity) {
+                return 0;
+            }
+            control = out++;
+            dst[control] = 0;
+            bit = 1;
+        }
+
+        if (in + LZSS_MIN_MATCH <= size) {
+            uint8_t hash = LZSS_HASH(&src[in]);
+            uint8_t candidate = table[hash];
+
+            table[hash] = (uint8_t)in;
+            if (candidate != LZSS_EMPTY) {
+                size_t max = size - in;
+                if (max > LZSS_MAX_MATCH) {
+                    max = LZSS_MAX_MATCH;
+                }
+                while ((length < max) && (src[candidate + length] == src[in + length])) {
+                    length++;
+                }
+                offset = in - candidate;
+            }
+        }
+
+        if (length >= LZSS_MIN_MATCH) {
+            size_t i;
+
+            if (out + 2 > capacity) {
+                return 0;
+            }
+            dst[control] |= bit;
+            dst[out++] = (uint8_t)(offset - 1);
+            dst[out++] = (uint8_t)(length - LZSS_MIN_MATCH);
+            for (i = in + 1; (i < in + length) && (i + LZSS_MIN_MATCH <= size); i++) {
+                table[LZSS_HASH(&src[i])] = (uint8_t)i;
+            }
+            in += length;
+        } else {
+            if (out >= capacity) {
+                return 0;
+            }
+            dst[out++] = src[in++];
+        }
+        bit <<= 1;
+    }
+
+    return out;
+}
+
+static int Lzss_decompress(const uint8_t src[], size_t size, uint8_t dst[], size_t capacity)
+{
+    size_t in = 0;
+    size_t out = 0;
+    uint8_t control = 0;
+    uint8_t bit = 0;
+
+    while (in < size) {
+        if (bit == 0) {
+            control = src[in++];
+            bit = 1;
+            continue;
+        }
+
+        if (control & bit) {
+            size_t offset;
+            size_t length;
+
+            if (in + 2 > size) {
+                return -1;
+            }
+            offset = (size_t)src[in] + 1;
+            length = (size_t)src[in + 1] + LZSS_MIN_MATCH;
+            in += 2;
+            if ((offset > out) || (out + length > capacity)) {
+                return -1;
+            }
+            for (; length > 0; length--, out++) {
+                dst[out] = dst[out - offset];
+            }
+        } else {
+            if (out >= capacity) {
+                return -1;
+            }
+            dst[out++] = src[in++];
+        }
+        bit <<= 1;
+    }
+
+    return (int)out;
+}
+
+
 Packet * Packet_new()
 {
+#if LAZURITE_PACKET_POOL_SIZE > 0
+    Payload *instance = (Payload *)PacketPool_acquire();
+#else
     Payload *instance = (Payload *)malloc(sizeof(Payload));
+#endif /* LAZURITE_PACKET_POOL_SIZE */
+    assert(instance != NULL);
+    if (instance == NULL) {
+        return NULL;
+    }
     Packet_initialize((Packet *)instance);
     return (Packet *)instance;
 }
 
 void Packet_free(Packet * instance)
 {
+#if LAZURITE_PACKET_POOL_SIZE > 0
+    PacketPool_release(instance);
+#else
     free((void *)instance);
+#endif /* LAZURITE_PACKET_POOL_SIZE */
     instance = NULL;
 }
 
+Packet * PacketPool_acquire()
+{
+#if LAZURITE_PACKET_POOL_SIZE > 0
+    Payload *instance = NULL;
+    uint8_t slot;
+
+    PACKET_POOL_LOCK();
+    if (!__poolReady) {
+        for (slot = 0; slot < LAZURITE_PACKET_POOL_SIZE; slot++) {
+            __poolNext[slot] = slot + 1;
+        }
+        __poolNext[LAZURITE_PACKET_POOL_SIZE - 1] = LAZURITE_PACKET_POOL_END;
+        __poolFree = 0;
+        __poolReady = true;
+    }
+
+    slot = __poolFree;
+    if (slot != LAZURITE_PACKET_POOL_END) {
+        __poolFree = __poolNext[slot];
+        __poolNext[slot] = LAZURITE_PACKET_POOL_USED;
+        instance = &__pool[slot];
+        if (++__poolUsed > __poolHighWaterMark) {
+            __poolHighWaterMark = __poolUsed;
+        }
+    } else {
+        __poolFailures++;
+    }
+    PACKET_POOL_UNLOCK();
+
+    return (Packet *)instance;
+#else
+    __poolFailures++;
+    return NULL;
+#endif /* LAZURITE_PACKET_POOL_SIZE */
+}
+
+void PacketPool_release(Packet * instance)
+{
+#if LAZURITE_PACKET_POOL_SIZE > 0
+    uint8_t slot;
+    bool used;
+
+    if (instance == NULL) {
+        return;
+    }
+
+    // A pointer from outside the pool or a slot which is already free is
+    // ignored, so that the free list and the counters stay consistent.
+    assert(((Payload *)instance >= __pool) && ((Payload *)instance < &__pool[LAZURITE_PACKET_POOL_SIZE]));
+    if (((Payload *)instance < __pool) || ((Payload *)instance >= &__pool[LAZURITE_PACKET_POOL_SIZE])) {
+        return;
+    }
+    slot = (uint8_t)((Payload *)instance - __pool);
+    if (&__pool[slot] != (Payload *)instance) {
+        return;
+    }
+
+    PACKET_POOL_LOCK();
+    used = (__poolNext[slot] == LAZURITE_PACKET_POOL_USED);
+    if (used) {
+        __poolNext[slot] = __poolFree;
+        __poolFree = slot;
+        __poolUsed--;
+    }
+    PACKET_POOL_UNLOCK();
+    assert(used);
+#endif /* LAZURITE_PACKET_POOL_SIZE */
+}
+
+uint8_t PacketPool_getUsed()
+{
+    return __poolUsed;
+}
+
+uint8_t PacketPool_getHighWaterMark()
+{
+    return __poolHighWaterMark;
+}
+
+uint16_t PacketPool_getFailureCount()
+{
+    return __poolFailures;
+}
+
 PacketType Packet_getType(const Packet * const self)
 {
     PacketType type = Payload_getPacketType((Payload *)self);
@@ -494,7 +2541,9 @@ PacketInterfaceBase* Packet_getInterface(const Packet * const self)
         Ack_getResponse,
         Ack_getResponseLength,
         Ack_setCommand,
-        Ack_setResponse
+        Ack_setResponse,
+        Ack_getResponseBytes,
+        Ack_setResponseBytes
     };
     static const Command __command = {
         {
@@ -507,7 +2556,9 @@ PacketInterfaceBase* Packet_getInterface(const Packet * const self)
         Command_getCommandParamLength,
         Command_setCommand,
         Command_setCommandParam,
-        Command_setResponseRequested
+        Command_setResponseRequested,
+        Command_getCommandParamBytes,
+        Command_setCommandParamBytes
     };
     static const Data __data = {
         {
@@ -519,7 +2570,9 @@ PacketInterfaceBase* Packet_getInterface(const Packet * const self)
         Data_getDataSize,
         Data_setData,
         Data_setFragmented,
-        Data_resetDataSize
+        Data_resetDataSize,
+        Data_getFragmentIndex,
+        Data_isLastFragment
     };
     static const Notice __notice = {
         {
@@ -530,7 +2583,7 @@ PacketInterfaceBase* Packet_getInterface(const Packet * const self)
         Notice_setNotice
     };
 
-    PacketType type = Packet_getType(self);
+    PacketType type = PACKET_GET_TYPE(self);
     PacketInterfaceBase *interface = NULL;
 
     switch(type) {
@@ -559,6 +2612,7 @@ void Packet_initialize(Packet * const self)
     Payload * const payload = self;
     payload->_payload[0] = 0;
     payload->_length = 0;
+    payload->_srcAddr = LAZURITE_ADDRESS_UNKNOWN;
     // memset(payload->_payload, 0, sizeof(uint8_t) * LAZURITE_PAYLOAD_SIZE + 1);
 }
 
@@ -567,17 +2621,390 @@ void Packet_setType(Packet * const self, PacketType type)
     Payload_setPacketType((Payload *)self, type);
 }
 
+void Reassembler_initialize(Reassembler * const self, uint8_t buffer[], size_t capacity)
+{
+    self->_buffer = buffer;
+    self->_capacity = capacity;
+    Reassembler_reset(self);
+}
+
+void Reassembler_reset(Reassembler * const self)
+{
+    self->_size = 0;
+    self->_base = 0;
+    self->_last = LAZURITE_FRAGMENT_MAX_COUNT;
+    memset(self->_window, 0, sizeof(self->_window));
+    self->_transferId = 0;
+    self->_busy = false;
+    self->_done = false;
+    self->_ackRequested = false;
+}
+
+ReassemblyStatus Reassembler_put(Reassembler * const self, const Packet * const packet)
+{
+    const Payload * const payload = (const Payload *)packet;
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    uint16_t header;
+    uint16_t index;
+    uint8_t transferId;
+
+    if (Payload_getPacketType(payload) != DATA) {
+        return REASSEMBLY_ERROR;
+    }
+
+    data = Data_getData(packet);
+    size = Data_getDataSize(packet);
+
+    if (!Payload_isFragmented(payload)) {
+        Reassembler_reset(self);
+        if (size > self->_capacity) {
+            return REASSEMBLY_ERROR;
+        }
+        memcpy(self->_buffer, data, size);
+        self->_size = size;
+        return REASSEMBLY_COMPLETE;
+    }
+
+    header = Payload_getFragmentHeader(payload);
+    index = header & LAZURITE_FRAGMENT_INDEX_MASK;
+    transferId = (uint8_t)((header & LAZURITE_FRAGMENT_XFER_MASK) >> LAZURITE_FRAGMENT_XFER_SHIFT);
+
+    if (Payload_isResponseRequested((Payload *)payload)) {
+        self->_ackRequested = true;
+    }
+
+    // A new transfer, or a marked first fragment which reuses the id of the
+    // previous transfer.
+    if ((transferId != self->_transferId) ||
+        (!self->_busy && (payload->_payload[LAZURITE_PACKET_FLAG_I] & LAZURITE_PACKET_FLAG_MASK_START))) {
+        Reassembler_reset(self);
+        self->_transferId = transferId;
+        self->_busy = true;
+        self->_ackRequested = Payload_isResponseRequested((Payload *)payload);
+    } else if (!self->_busy) {
+        if (self->_done) {
+            // A fragment of the completed transfer which has been sent again
+            // because the sender missed our ACK.
+            return REASSEMBLY_IN_PROGRESS;
+        }
+        self->_busy = true;
+    }
+
+    if (header & LAZURITE_FRAGMENT_FLAG_MASK_FEC) {
+        return Reassembler_putParity(self, header, data, size);
+    }
+
+    if (index < self->_base) {
+        return REASSEMBLY_IN_PROGRESS;
+    }
+
+    offset = (size_t)index * LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+    if ((index - self->_base >= LAZURITE_FRAGMENT_WINDOW_SIZE) ||
+        (offset + size > self->_capacity) ||
+        (!(header & LAZURITE_FRAGMENT_FLAG_MASK_LAST) && (size != LAZURITE_FRAGMENT_DATA_MAX_SIZE))) {
+        DEBUG_PRINT("Reassembling fragments failed.");
+        self->_busy = false;
+        return REASSEMBLY_ERROR;
+    }
+
+    memcpy(&self->_buffer[offset], data, size);
+    if (header & LAZURITE_FRAGMENT_FLAG_MASK_LAST) {
+        self->_last = index;
+        self->_size = offset + size;
+    }
+
+    return Reassembler_mark(self, index);
+}
+
+static ReassemblyStatus Reassembler_mark(Reassembler * const self, uint16_t index)
+{
+    Bitmap_set(self->_window, index - self->_base);
+    while (Bitmap_test(self->_window, 0)) {
+        Bitmap_shift(self->_window, sizeof(self->_window), 1);
+        self->_base++;
+    }
+
+    if (self->_base > self->_last) {
+        self->_busy = false;
+        self->_done = true;
+        return REASSEMBLY_COMPLETE;
+    }
+
+    return REASSEMBLY_IN_PROGRESS;
+}
+
+// Rebuilds the only missing fragment of a group from its parity. The parity
+// of the last group is used once the last fragment, which gives the size of
+// the transfer, has arrived.
+static ReassemblyStatus Reassembler_putParity(Reassembler * const self, uint16_t header, const uint8_t parity[], size_t size)
+{
+    uint16_t groupSize = (header & LAZURITE_FEC_SIZE_MASK) + 1;
+    uint16_t first = (uint16_t)(((header & LAZURITE_FRAGMENT_INDEX_MASK) >> LAZURITE_FEC_GROUP_SHIFT) * groupSize);
+    uint16_t end = first + groupSize;
+    uint16_t missing = LAZURITE_FRAGMENT_MAX_COUNT;
+    uint16_t index;
+    uint8_t *dst;
+    size_t i;
+
+    if (header & LAZURITE_FRAGMENT_FLAG_MASK_LAST) {
+        if ((self->_last == LAZURITE_FRAGMENT_MAX_COUNT) || (self->_last < first) || (self->_last >= end)) {
+            return REASSEMBLY_IN_PROGRESS;
+        }
+        end = self->_last + 1;
+    }
+
+    for (index = first; index < end; index++) {
+        if (index < self->_base) {
+            continue;
+        }
+        if (index - self->_base >= LAZURITE_FRAGMENT_WINDOW_SIZE) {
+            return REASSEMBLY_IN_PROGRESS;
+        }
+        if (Bitmap_test(self->_window, index - self->_base)) {
+            continue;
+        }
+        if (missing != LAZURITE_FRAGMENT_MAX_COUNT) {
+            return REASSEMBLY_IN_PROGRESS;
+        }
+        missing = index;
+    }
+    if ((missing == LAZURITE_FRAGMENT_MAX_COUNT) || (size != LAZURITE_FRAGMENT_DATA_MAX_SIZE) ||
+        ((size_t)(missing + 1) * LAZURITE_FRAGMENT_DATA_MAX_SIZE > self->_capacity)) {
+        return REASSEMBLY_IN_PROGRESS;
+    }
+
+    dst = &self->_buffer[(size_t)missing * LAZURITE_FRAGMENT_DATA_MAX_SIZE];
+    memcpy(dst, parity, size);
+    for (index = first; index < end; index++) {
+        const uint8_t *src = &self->_buffer[(size_t)index * LAZURITE_FRAGMENT_DATA_MAX_SIZE];
+        size_t length = LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+
+        if (index == missing) {
+            continue;
+        }
+        if (index == self->_last) {
+            length = self->_size - (size_t)index * LAZURITE_FRAGMENT_DATA_MAX_SIZE;
+        }
+        for (i = 0; i < length; i++) {
+            dst[i] ^= src[i];
+        }
+    }
+    STATS_COUNT_RECOVERED();
+
+    return Reassembler_mark(self, missing);
+}
+
+bool Reassembler_isAckRequested(const Reassembler * const self)
+{
+    return self->_ackRequested;
+}
+
+size_t Reassembler_getSize(const Reassembler * const self)
+{
+    return self->_size;
+}
+
+// Commands go to the entry of their command byte, or else to the COMMAND
+// handler, which is acknowledged with an empty response. Other packets go
+// to the handler of their type.
+int Dispatcher_dispatch(const Dispatcher * const self, const Packet * const packet)
+{
+    PacketType type = PACKET_GET_TYPE(packet);
+
+    if (type == COMMAND) {
+        uint8_t command = COMMAND_GET_COMMAND(packet);
+
+        if ((command < self->commandCount) && (self->commands[command] != NULL)) {
+            return Dispatcher_runCommand(self, self->commands[command], packet);
+        }
+    }
+    if ((type < LAZURITE_DISPATCH_PACKET_TYPES) && (self->handlers[type] != NULL)) {
+        self->handlers[type](packet);
+        if ((type == COMMAND) && COMMAND_IS_RESPONSE_REQUESTED(packet)) {
+            return Dispatcher_acknowledge(self, packet, (const uint8_t *)"", 0);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+int Dispatcher_listen(const Dispatcher * const self, Packet *packet)
+{
+    int ret;
+
+    ret = LazuriteWireless_listen(packet);
+    if (ret != 0) {
+        return ret;
+    }
+
+    return Dispatcher_dispatch(self, packet);
+}
+
+// The handler writes the response of the ACK and returns its length, or -1
+// for no ACK.
+static int Dispatcher_runCommand(const Dispatcher * const self, CommandHandler handler, const Packet * const packet)
+{
+    uint8_t response[LAZURITE_DISPATCH_RESPONSE_SIZE];
+    int length;
+
+    length = handler(packet, response, sizeof(response));
+    if ((length < 0) || !COMMAND_IS_RESPONSE_REQUESTED(packet)) {
+        return 0;
+    }
+    if ((size_t)length > sizeof(response)) {
+        length = sizeof(response);
+    }
+
+    return Dispatcher_acknowledge(self, packet, response, (size_t)length);
+}
+
+// The ACK goes to the sender of the command, which is known when the
+// sender has the duplicate filter on, or else to ackAddr.
+static int Dispatcher_acknowledge(const Dispatcher * const self, const Packet * const packet, const uint8_t response[], size_t length)
+{
+    uint16_t dstAddr = PACKET_GET_SOURCE(packet);
+    int ret;
+
+    if (dstAddr == LAZURITE_ADDRESS_UNKNOWN) {
+        dstAddr = self->ackAddr;
+    }
+
+    ret = LazuriteWireless_sendBinaryAck(self->panid, dstAddr, COMMAND_GET_COMMAND(packet), response, length);
+
+    return TX_ACCEPTED(ret) ? 0 : -1;
+}
+
+// A field is a type byte, a length byte and the value. Integers are stored
+// big-endian in as many bytes as their type.
+void TlvWriter_initialize(TlvWriter * const self, uint8_t buffer[], size_t capacity)
+{
+    self->_buffer = buffer;
+    self->_capacity = capacity;
+    self->_size = 0;
+}
+
+int TlvWriter_put(TlvWriter * const self, uint8_t type, const void *value, size_t length)
+{
+    if ((length > LAZURITE_TLV_VALUE_MAX_SIZE) || (self->_size + LAZURITE_TLV_HEADER_SIZE + length > self->_capacity)) {
+        return -1;
+    }
+
+    self->_buffer[self->_size++] = type;
+    self->_buffer[self->_size++] = (uint8_t)length;
+    memcpy(&self->_buffer[self->_size], value, length);
+    self->_size += length;
+
+    return 0;
+}
+
+int TlvWriter_putUint8(TlvWriter * const self, uint8_t type, uint8_t value)
+{
+    return TlvWriter_put(self, type, &value, sizeof(value));
+}
+
+int TlvWriter_putUint16(TlvWriter * const self, uint8_t type, uint16_t value)
+{
+    uint8_t bytes[2];
+
+    bytes[0] = (uint8_t)(value >> 8);
+    bytes[1] = (uint8_t)(value & 0xff);
+
+    return TlvWriter_put(self, type, bytes, sizeof(bytes));
+}
+
+int TlvWriter_putUint32(TlvWriter * const self, uint8_t type, uint32_t value)
+{
+    uint8_t bytes[4];
+
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)(value & 0xff);
+
+    return TlvWriter_put(self, type, bytes, sizeof(bytes));
+}
+
+int TlvWriter_putString(TlvWriter * const self, uint8_t type, const char value[])
+{
+    return TlvWriter_put(self, type, value, strlen(value));
+}
+
+size_t TlvWriter_getSize(const TlvWriter * const self)
+{
+    return self->_size;
+}
+
+void TlvReader_initialize(TlvReader * const self, const uint8_t buffer[], size_t size)
+{
+    self->_buffer = buffer;
+    self->_size = size;
+    self->_offset = 0;
+}
+
+// Returns 0 with the next field, 1 at the end and -1 if the last field is
+// cut short.
+int TlvReader_next(TlvReader * const self, TlvField * const field)
+{
+    size_t length;
+
+    if (self->_offset >= self->_size) {
+        return 1;
+    }
+    if (self->_offset + LAZURITE_TLV_HEADER_SIZE > self->_size) {
+        return -1;
+    }
+    length = self->_buffer[self->_offset + 1];
+    if (self->_offset + LAZURITE_TLV_HEADER_SIZE + length > self->_size) {
+        return -1;
+    }
+
+    field->type = self->_buffer[self->_offset];
+    field->length = (uint8_t)length;
+    field->value = &self->_buffer[self->_offset + LAZURITE_TLV_HEADER_SIZE];
+    self->_offset += LAZURITE_TLV_HEADER_SIZE + length;
+
+    return 0;
+}
+
+// Looks for a field from the start, so fields can be read in any order.
+int TlvReader_find(TlvReader * const self, uint8_t type, TlvField * const field)
+{
+    int ret;
+
+    self->_offset = 0;
+    while ((ret = TlvReader_next(self, field)) == 0) {
+        if (field->type == type) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+uint32_t TlvField_getUint(const TlvField * const self)
+{
+    uint32_t value = 0;
+    uint8_t i;
+
+    for (i = 0; (i < self->length) && (i < sizeof(value)); i++) {
+        value = (value << 8) | self->value[i];
+    }
+
+    return value;
+}
+
 
 static uint8_t Ack_getCommand(const Packet * const self)
 {
-    const uint8_t *body = Payload_getBodyArray((Payload *)self);
-    return body[LAZURITE_ACK_CMD_I];
+    return ACK_GET_COMMAND(self);
 }
 
 static const char* Ack_getResponse(const Packet * const self)
 {
-    const char *body = (const char *)Payload_getBodyArray((Payload *)self);
-    return &body[LAZURITE_ACK_RESPONSE_I];
+    return ACK_GET_RESPONSE(self);
 }
 
 // static char* Ack_getResponseArray(Packet * const self)
@@ -588,19 +3015,7 @@ static const char* Ack_getResponse(const Packet * const self)
 
 static size_t Ack_getResponseLength(const Packet * const self)
 {
-    const char *body = (const char *)Payload_getBodyArray((Payload *)self);
-    const char *response = &body[LAZURITE_ACK_RESPONSE_I];
-    size_t length = Payload_getLength((Payload *)self) - LAZURITE_ACK_COMMAND_SIZE;
-
-#ifndef NDEBUG
-    {
-        size_t len;
-        len = strlen(response);
-        assert(len == length);
-    }
-#endif
-
-    return length;
+    return ACK_GET_RESPONSE_LENGTH(self);
 }
 
 static void Ack_initialize(Packet * const self)
@@ -617,14 +3032,24 @@ static void Ack_setCommand(Packet * const self, uint8_t command)
 
 static size_t Ack_setResponse(Packet * const self, const char response[])
 {
-    char *body = (char *)Payload_getBodyArray((Payload *)self);
-    char *dst = &body[LAZURITE_ACK_RESPONSE_I];
-    size_t length = strlen(response);
+    return Ack_setResponseBytes(self, (const uint8_t *)response, strlen(response));
+}
+
+static const uint8_t* Ack_getResponseBytes(const Packet * const self)
+{
+    return ACK_GET_RESPONSE_BYTES(self);
+}
+
+// The terminator after the response is not sent. It only lets getResponse
+// return a C string.
+static size_t Ack_setResponseBytes(Packet * const self, const uint8_t response[], size_t length)
+{
+    uint8_t *body = Payload_getBodyArray((Payload *)self);
 
     if (length > LAZURITE_ACK_RESPONSE_MAX_LEN) {
         length = LAZURITE_ACK_RESPONSE_MAX_LEN;
     }
-    strncpy(dst, response, length + 1);
+    memcpy(&body[LAZURITE_ACK_RESPONSE_I], response, length);
     body[LAZURITE_ACK_RESPONSE_I + length] = '\0';
     Payload_resetLength((Payload *)self, LAZURITE_ACK_COMMAND_SIZE + length);
 
@@ -656,19 +3081,17 @@ static void Command_enableAckRequest(Packet * const self)
 
 static bool Command_isResponseRequested(const Packet * const self)
 {
-    return Payload_isResponseRequested((Payload * )self);
+    return COMMAND_IS_RESPONSE_REQUESTED(self);
 }
 
 static uint8_t Command_getCommand(const Packet * const self)
 {
-    const uint8_t *body = Payload_getBodyArray((Payload *)self);
-    return body[LAZURITE_COMMAND_CMD_I];
+    return COMMAND_GET_COMMAND(self);
 }
 
 static const char* Command_getCommandParam(const Packet * const self)
 {
-    const char *body = (const char *)Payload_getBodyArray((Payload *)self);
-    return body + LAZURITE_COMMAND_PARAM_I;
+    return COMMAND_GET_PARAM(self);
 }
 
 // static char* Command_getCommandParamArray(Packet * const self)
@@ -679,19 +3102,7 @@ static const char* Command_getCommandParam(const Packet * const self)
 
 static size_t Command_getCommandParamLength(const Packet * const self)
 {
-    const char *body = (const char *)Payload_getBodyArray((Payload *)self);
-    const char *param = &body[LAZURITE_COMMAND_PARAM_I];
-    size_t length = Payload_getLength((Payload *)self) - LAZURITE_COMMAND_CMD_SIZE;
-
-#ifndef NDEBUG
-    {
-        size_t len;
-        len = strlen(param);
-        assert(len == length);
-    }
-#endif
-
-    return length;
+    return COMMAND_GET_PARAM_LENGTH(self);
 }
 
 static void Command_setCommand(Packet * const self, uint8_t command)
@@ -702,25 +3113,34 @@ static void Command_setCommand(Packet * const self, uint8_t command)
 
 static size_t Command_setCommandParam(Packet * const self, const char param[])
 {
-    char *body = (char *)Payload_getBodyArray((Payload *)self);
-    char *dst = &body[LAZURITE_COMMAND_PARAM_I];
-    size_t length = strlen(param);
+    return Command_setCommandParamBytes(self, (const uint8_t *)param, strlen(param));
+}
+
+static void Command_setResponseRequested(Packet * const self, bool requested)
+{
+    Payload_setResponseRequested((Payload *)self, requested);
+}
+
+static const uint8_t* Command_getCommandParamBytes(const Packet * const self)
+{
+    return COMMAND_GET_PARAM_BYTES(self);
+}
+
+// As with Ack_setResponseBytes, the terminator is not sent.
+static size_t Command_setCommandParamBytes(Packet * const self, const uint8_t param[], size_t length)
+{
+    uint8_t *body = Payload_getBodyArray((Payload *)self);
 
     if (length > LAZURITE_COMMAND_PARAM_MAX_LEN) {
         length = LAZURITE_COMMAND_PARAM_MAX_LEN;
     }
-    strncpy(dst, param, length + 1);
+    memcpy(&body[LAZURITE_COMMAND_PARAM_I], param, length);
     body[LAZURITE_COMMAND_PARAM_I + length] = '\0';
-    Payload_resetLength((Payload * )self, LAZURITE_COMMAND_CMD_SIZE + length);
+    Payload_resetLength((Payload *)self, LAZURITE_COMMAND_CMD_SIZE + length);
 
     return length;
 }
 
-static void Command_setResponseRequested(Packet * const self, bool requested)
-{
-    Payload_setResponseRequested((Payload *)self, requested);
-}
-
 
 // static int Command_resetCommandParamLength(Packet * const self, size_t length)
 // {
@@ -736,22 +3156,22 @@ static void Command_setResponseRequested(Packet * const self, bool requested)
 
 static bool Data_isFragmented(const Packet * const self)
 {
-    return Payload_isFragmented((Payload * )self);
+    return PACKET_IS_FRAGMENTED(self);
 }
 
 static const uint8_t* Data_getData(const Packet * const self)
 {
-    return Payload_getBodyArray((Payload *)self);
+    return DATA_GET_DATA(self);
 }
 
 static uint8_t* Data_getDataArray(Packet * const self)
 {
-    return Payload_getBodyArray((Payload *)self);
+    return Payload_getBodyArray((Payload *)self) + Data_getDataOffset(self);
 }
 
 static size_t Data_getDataSize(const Packet * const self)
 {
-    return Payload_getLength((Payload * )self);
+    return DATA_GET_DATA_SIZE(self);
 }
 
 static void Data_initialize(Packet * const self)
@@ -762,14 +3182,15 @@ static void Data_initialize(Packet * const self)
 
 static size_t Data_setData(Packet * const self, const uint8_t from[], size_t size)
 {
-    uint8_t *dst = Payload_getBodyArray((Payload *)self);
+    uint8_t *dst = Data_getDataArray(self);
+    size_t max = Data_getDataMaxSize(self);
 
-    if (size > LAZURITE_DATA_MAX_SIZE) {
-        size = LAZURITE_DATA_MAX_SIZE;
+    if (size > max) {
+        size = max;
     }
 
     memcpy(dst, from, size);
-    Payload_resetLength((Payload * )self, size);
+    Payload_resetLength((Payload * )self, Data_getDataOffset(self) + size);
 
     return size;
 }
@@ -781,18 +3202,38 @@ static void Data_setFragmented(Packet * const self, bool fragmented)
 
 static int Data_resetDataSize(Packet * const self, size_t size)
 {
-    assert(!(size > LAZURITE_DATA_MAX_SIZE));
-    if (size > LAZURITE_DATA_MAX_SIZE) {
+    assert(!(size > Data_getDataMaxSize(self)));
+    if (size > Data_getDataMaxSize(self)) {
         return -1;
     }
-    Payload_resetLength((Payload *)self, size);
+    Payload_resetLength((Payload *)self, Data_getDataOffset(self) + size);
     return 0;
 }
 
+static uint16_t Data_getFragmentIndex(const Packet * const self)
+{
+    return DATA_GET_FRAGMENT_INDEX(self);
+}
+
+static bool Data_isLastFragment(const Packet * const self)
+{
+    return DATA_IS_LAST_FRAGMENT(self);
+}
+
+static size_t Data_getDataOffset(const Packet * const self)
+{
+    return Payload_isFragmented((Payload *)self) ? LAZURITE_FRAGMENT_DATA_I : 0;
+}
+
+static size_t Data_getDataMaxSize(const Packet * const self)
+{
+    return Payload_isFragmented((Payload *)self) ? LAZURITE_FRAGMENT_DATA_MAX_SIZE : LazuriteWireless_getBodyMaxSize();
+}
+
 
 static const char* Notice_getNotice(const Packet * const self)
 {
-    return (const char *)Payload_getBodyArray((Payload *)self);
+    return NOTICE_GET_NOTICE(self);
 }
 
 // static char* Notice_getNoticeArray(Packet * const self)
@@ -802,7 +3243,7 @@ static const char* Notice_getNotice(const Packet * const self)
 
 static size_t Notice_getNoticeLength(const Packet * const self)
 {
-    return Payload_getLength((Payload * )self);
+    return NOTICE_GET_NOTICE_LENGTH(self);
 }
 
 static void Notice_initialize(Packet * const self)
@@ -10,11 +10,115 @@ typedef enum {
     DATA = 0,
     COMMAND = 1,
     ACK = 2,
-    NOTICE = 3
+    NOTICE = 3,
+    AGGREGATE = 4
 } PacketType;
 
+#define LAZURITE_FRAGMENT_WINDOW_SIZE   32
+
 typedef void Packet;
 
+// Returned by the blocking sends instead of SUBGHZ_OK when the radio is busy
+// and the packet is put in the transmit queue: it is not on air yet, and its
+// outcome is counted in the stats and the trace when it is done. SubGHz.send
+// never returns it.
+#define LAZURITE_TX_QUEUED              SUBGHZ_DUMMY
+
+#define LAZURITE_STATS_PACKET_TYPES     5
+#define LAZURITE_STATS_FAILURE_CODES    16
+#define LAZURITE_STATS_LATENCY_BUCKETS  8
+
+typedef struct {
+    uint16_t txFrames[LAZURITE_STATS_PACKET_TYPES];
+    uint32_t txBytes[LAZURITE_STATS_PACKET_TYPES];
+    uint16_t rxFrames[LAZURITE_STATS_PACKET_TYPES];
+    uint32_t rxBytes[LAZURITE_STATS_PACKET_TYPES];
+    uint16_t txFailures[LAZURITE_STATS_FAILURE_CODES];
+    uint16_t retries;
+    uint16_t recovered;
+    uint16_t duplicates;
+    uint8_t rssiMin;
+    uint8_t rssiMax;
+    uint32_t rssiSum;
+    uint16_t rssiCount;
+    // Send latency in ms: [0, 2), [2, 4), [4, 8), ... [128, infinity)
+    uint16_t latency[LAZURITE_STATS_LATENCY_BUCKETS];
+} WirelessStats;
+
+#ifndef LAZURITE_TRACE_BODY_SIZE
+#define LAZURITE_TRACE_BODY_SIZE        8
+#endif /* LAZURITE_TRACE_BODY_SIZE */
+
+typedef enum {
+    TRACE_TX = 0,
+    TRACE_RX = 1
+} TraceDirection;
+
+typedef struct {
+    uint32_t time;          // micros()
+    uint16_t panid;
+    uint16_t srcAddr;
+    uint16_t dstAddr;
+    uint8_t direction;
+    uint8_t rssi;
+    uint8_t status;
+    uint8_t header;
+    uint8_t length;         // header and body, as on air
+    uint8_t body[LAZURITE_TRACE_BODY_SIZE];
+} TraceEvent;
+
+typedef void (*SendCallback)(const Packet * const packet, uint8_t rssi, uint8_t status);
+
+typedef enum {
+    REASSEMBLY_ERROR = -1,
+    REASSEMBLY_IN_PROGRESS = 0,
+    REASSEMBLY_COMPLETE = 1
+} ReassemblyStatus;
+
+typedef struct {
+    uint8_t *_buffer;
+    size_t _capacity;
+    size_t _size;
+    uint16_t _base;
+    uint16_t _last;
+    uint8_t _window[LAZURITE_FRAGMENT_WINDOW_SIZE / 8];
+    uint8_t _transferId;
+    bool _busy;
+    bool _done;
+    bool _ackRequested;
+} Reassembler;
+
+typedef struct {
+    uint8_t *_buffer;
+    size_t _capacity;
+    size_t _size;
+} TlvWriter;
+
+typedef struct {
+    const uint8_t *_buffer;
+    size_t _size;
+    size_t _offset;
+} TlvReader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    const uint8_t *value;
+} TlvField;
+
+#define LAZURITE_DISPATCH_PACKET_TYPES  4
+
+typedef void (*PacketHandler)(const Packet * const packet);
+typedef int (*CommandHandler)(const Packet * const packet, uint8_t response[], size_t capacity);
+
+typedef struct {
+    uint16_t panid;
+    uint16_t ackAddr;
+    PacketHandler handlers[LAZURITE_DISPATCH_PACKET_TYPES];
+    const CommandHandler *commands;
+    uint16_t commandCount;
+} Dispatcher;
+
 typedef struct {
     void (*initialize)();
 } PacketInterfaceBase;
@@ -25,12 +129,27 @@ typedef struct {
     SUBGHZ_MSG (*end)();
     SUBGHZ_MSG (*enableRx)();
     SUBGHZ_MSG (*disableRx)();
+    SUBGHZ_MSG (*enableRxRing)();
     int (*listen)(Packet *);
+    int (*poll)(Packet *);
+    const Packet* (*peek)();
+    uint16_t (*getRxOverflowCount)();
     SUBGHZ_MSG (*send)(const Packet *, uint16_t panid, uint16_t dstAddr);
+    int (*sendAsync)(const Packet *, uint16_t panid, uint16_t dstAddr, SendCallback callback);
+    uint8_t (*getTxQueueLength)();
     size_t (*sendData)(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size, bool fragmented);
+    size_t (*sendDataWithAck)(uint16_t panid, uint16_t dstAddr, const uint8_t data[], size_t size);
+    int (*sendFragmentAck)(uint16_t panid, uint16_t dstAddr, Reassembler * const reassembler);
+    uint8_t* (*reserveData)(bool fragmented, size_t *capacity);
+    size_t (*commitData)(uint16_t panid, uint16_t dstAddr, size_t size, bool last);
+    uint8_t* (*reserveDataAsync)(bool fragmented, size_t *capacity);
+    int (*commitDataAsync)(uint16_t panid, uint16_t dstAddr, size_t size, bool last, SendCallback callback);
+    void (*cancelDataAsync)();
     int (*sendCommand)(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[]);
     int (*sendCommandWithAck)(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char param[]);
     int (*sendAck)(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const char response[]);
+    int (*sendBinaryCommand)(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t param[], size_t length, bool ackRequested);
+    int (*sendBinaryAck)(uint16_t panid, uint16_t dstAddr, uint8_t cmd, const uint8_t response[], size_t length);
     int (*sendNotice)(uint16_t panid, uint16_t dstAddr, const char notice[]);
     uint8_t (*getAddrType)();
     uint16_t (*getMyAddress)();
@@ -39,6 +158,18 @@ typedef struct {
     SUBGHZ_MSG (*setPromiscuous)(bool on);
     uint8_t (*setTxRetry)();
     SUBGHZ_MSG (*setSendMode)(uint8_t addrType, uint8_t txRetry);
+    void (*setCompression)(bool on);
+    uint8_t (*getCompressionRatio)();
+    void (*setAggregation)(bool on, uint16_t deadline);
+    SUBGHZ_MSG (*flush)();
+    void (*setFec)(uint8_t groupSize);
+    void (*setDuplicateFilter)(bool on, uint16_t expiry);
+    void (*getStats)(WirelessStats *stats);
+    void (*resetStats)();
+    int (*sendStats)(uint16_t panid, uint16_t dstAddr);
+    void (*setTrace)(bool on);
+    size_t (*getTrace)(TraceEvent events[], size_t count);
+    size_t (*dumpTrace)();
 } LazuriteWireless;
 
 typedef struct {
@@ -50,6 +181,8 @@ typedef struct {
     void (*setCommand)(Packet * const, uint8_t command);
     size_t (*setResponse)(Packet * const, const char response[]);
     // int (*resetResponseLength)(Packet * const, size_t length);
+    const uint8_t* (*getResponseBytes)(const Packet * const);
+    size_t (*setResponseBytes)(Packet * const, const uint8_t response[], size_t length);
 } Ack;
 
 typedef struct {
@@ -64,6 +197,8 @@ typedef struct {
     size_t (*setCommandParam)(Packet * const, const char param[]);
     void (*setResponseRequested)(Packet * const, bool requested);
     // int (*resetCommandParamLength)(Packet * const, size_t length);
+    const uint8_t* (*getCommandParamBytes)(const Packet * const);
+    size_t (*setCommandParamBytes)(Packet * const, const uint8_t param[], size_t length);
 } Command;
 
 typedef struct {
@@ -75,6 +210,8 @@ typedef struct {
     size_t (*setData)(Packet * const, const uint8_t from[], size_t size);
     void (*setFragmented)(Packet * const, bool fragmented);
     int (*resetDataSize)(Packet * const, size_t size);
+    uint16_t (*getFragmentIndex)(const Packet * const);
+    bool (*isLastFragment)(const Packet * const);
 } Data;
 
 typedef struct {
@@ -93,6 +230,33 @@ extern PacketInterfaceBase* Packet_getInterface(const Packet * const);
 extern void Packet_initialize(Packet * const);
 extern void Packet_setType(Packet * const, PacketType);
 
+extern Packet * PacketPool_acquire();
+extern void PacketPool_release(Packet *);
+extern uint8_t PacketPool_getUsed();
+extern uint8_t PacketPool_getHighWaterMark();
+extern uint16_t PacketPool_getFailureCount();
+
+extern void Reassembler_initialize(Reassembler * const, uint8_t buffer[], size_t capacity);
+extern void Reassembler_reset(Reassembler * const);
+extern ReassemblyStatus Reassembler_put(Reassembler * const, const Packet * const);
+extern size_t Reassembler_getSize(const Reassembler * const);
+extern bool Reassembler_isAckRequested(const Reassembler * const);
+
+extern int Dispatcher_dispatch(const Dispatcher * const, const Packet * const);
+extern int Dispatcher_listen(const Dispatcher * const, Packet *);
+
+extern void TlvWriter_initialize(TlvWriter * const, uint8_t buffer[], size_t capacity);
+extern int TlvWriter_put(TlvWriter * const, uint8_t type, const void *value, size_t length);
+extern int TlvWriter_putUint8(TlvWriter * const, uint8_t type, uint8_t value);
+extern int TlvWriter_putUint16(TlvWriter * const, uint8_t type, uint16_t value);
+extern int TlvWriter_putUint32(TlvWriter * const, uint8_t type, uint32_t value);
+extern int TlvWriter_putString(TlvWriter * const, uint8_t type, const char value[]);
+extern size_t TlvWriter_getSize(const TlvWriter * const);
+extern void TlvReader_initialize(TlvReader * const, const uint8_t buffer[], size_t size);
+extern int TlvReader_next(TlvReader * const, TlvField * const field);
+extern int TlvReader_find(TlvReader * const, uint8_t type, TlvField * const field);
+extern uint32_t TlvField_getUint(const TlvField * const);
+
 extern const LazuriteWireless Wireless;
 
 #endif /* _LAZURITE_WIRELESS_H_ */
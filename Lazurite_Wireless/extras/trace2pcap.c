@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts a trace written by Wireless.dumpTrace() into a pcap file, or
+// lists it as text.
+//
+//   trace2pcap trace.bin trace.pcap
+//   trace2pcap -l trace.bin
+//
+// Every event becomes an IEEE 802.15.4 data frame with short addresses,
+// behind an 802.15.4 TAP header (LINKTYPE_IEEE802_15_4_TAP) whose LQI field
+// holds the RSSI byte of the radio. The MAC sequence number is the index of
+// the event in the trace. Only the first bytes of each body are recorded,
+// so the frames are truncated: their original length is that on air.
+
+#define TRACE_MAGIC         "LZTR"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   8
+#define TRACE_FIELDS_SIZE   15
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_SNAPLEN        65535
+#define LINKTYPE_IEEE802_15_4_TAP   283
+
+#define TAP_FCS_TYPE        0
+#define TAP_LQI             10
+#define TAP_HEADER_SIZE     20
+#define MAC_HEADER_SIZE     9
+// Data frame, PAN ID compression, short destination and source addresses.
+#define MAC_FRAME_CONTROL   0x8841
+
+typedef struct {
+    uint32_t time;
+    uint16_t panid;
+    uint16_t srcAddr;
+    uint16_t dstAddr;
+    uint8_t direction;
+    uint8_t rssi;
+    uint8_t status;
+    uint8_t header;
+    uint8_t length;
+    const uint8_t *body;
+} Event;
+
+static const char *__types[] = { "DATA", "COMMAND", "ACK", "NOTICE", "AGGREGATE", "5", "6", "7" };
+
+static uint16_t read16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)(value & 0xff);
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, (uint16_t)(value & 0xffff));
+    put16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void parse(const uint8_t *record, Event *event)
+{
+    event->time = read32(&record[0]);
+    event->panid = read16(&record[4]);
+    event->srcAddr = read16(&record[6]);
+    event->dstAddr = read16(&record[8]);
+    event->direction = record[10];
+    event->rssi = record[11];
+    event->status = record[12];
+    event->header = record[13];
+    event->length = record[14];
+    event->body = &record[TRACE_FIELDS_SIZE];
+}
+
+static size_t captured(const Event *event, uint8_t bodySize)
+{
+    size_t length = (event->length > 0) ? event->length - 1u : 0;
+
+    return (length < bodySize) ? length : bodySize;
+}
+
+static void list(const Event *event, uint64_t time, uint8_t bodySize)
+{
+    size_t i;
+
+    printf("%10.6f %s %04x %04x>%04x rssi=%3u status=%2u %-9s 0x%02x len=%3u ",
+           time / 1e6, event->direction ? "rx" : "tx", event->panid, event->srcAddr, event->dstAddr,
+           event->rssi, event->status, __types[event->header & 0x07], event->header, event->length);
+    for (i = 0; i < captured(event, bodySize); i++) {
+        printf("%02x", event->body[i]);
+    }
+    printf("\n");
+}
+
+static void writePcap(FILE *out, const Event *event, uint64_t time, uint8_t sequence, uint8_t bodySize)
+{
+    uint8_t frame[16 + TAP_HEADER_SIZE + MAC_HEADER_SIZE + 1 + 255];
+    size_t body = captured(event, bodySize);
+    size_t size = TAP_HEADER_SIZE + MAC_HEADER_SIZE + 1 + body;
+    uint8_t *p = frame;
+
+    memset(frame, 0, sizeof(frame));
+    put32(p, (uint32_t)(time / 1000000));
+    put32(p + 4, (uint32_t)(time % 1000000));
+    put32(p + 8, (uint32_t)size);
+    put32(p + 12, (uint32_t)(TAP_HEADER_SIZE + MAC_HEADER_SIZE + event->length));
+    p += 16;
+
+    // TAP header and its TLVs, each padded to 4 bytes.
+    put16(p + 2, TAP_HEADER_SIZE);
+    put16(p + 4, TAP_FCS_TYPE);
+    put16(p + 6, 1);
+    p[8] = 0;
+    put16(p + 12, TAP_LQI);
+    put16(p + 14, 1);
+    p[16] = event->rssi;
+    p += TAP_HEADER_SIZE;
+
+    put16(p, MAC_FRAME_CONTROL);
+    p[2] = sequence;
+    put16(p + 3, event->panid);
+    put16(p + 5, event->dstAddr);
+    put16(p + 7, event->srcAddr);
+    p += MAC_HEADER_SIZE;
+
+    p[0] = event->header;
+    memcpy(&p[1], event->body, body);
+
+    fwrite(frame, 1, 16 + size, out);
+}
+
+int main(int argc, char *argv[])
+{
+    int listing = (argc == 3) && (strcmp(argv[1], "-l") == 0);
+    FILE *in;
+    FILE *out = NULL;
+    uint8_t header[TRACE_HEADER_SIZE];
+    uint8_t record[TRACE_FIELDS_SIZE + 255];
+    uint8_t bodySize;
+    uint16_t count;
+    uint64_t time = 0;
+    uint32_t last = 0;
+    unsigned int i;
+
+    if ((argc != 3) || (!listing && (argv[1][0] == '-'))) {
+        fprintf(stderr, "usage: %s trace.bin trace.pcap\n       %s -l trace.bin\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    in = fopen(listing ? argv[2] : argv[1], "rb");
+    if (in == NULL) {
+        perror(listing ? argv[2] : argv[1]);
+        return EXIT_FAILURE;
+    }
+    if ((fread(header, 1, sizeof(header), in) != sizeof(header)) || (memcmp(header, TRACE_MAGIC, 4) != 0) ||
+        (header[4] != TRACE_VERSION)) {
+        fprintf(stderr, "not a trace\n");
+        return EXIT_FAILURE;
+    }
+    bodySize = header[5];
+    count = read16(&header[6]);
+
+    if (!listing) {
+        uint8_t global[24];
+
+        out = fopen(argv[2], "wb");
+        if (out == NULL) {
+            perror(argv[2]);
+            return EXIT_FAILURE;
+        }
+        put32(global, PCAP_MAGIC);
+        put16(global + 4, 2);
+        put16(global + 6, 4);
+        put32(global + 8, 0);
+        put32(global + 12, 0);
+        put32(global + 16, PCAP_SNAPLEN);
+        put32(global + 20, LINKTYPE_IEEE802_15_4_TAP);
+        fwrite(global, 1, sizeof(global), out);
+    }
+
+    for (i = 0; i < count; i++) {
+        Event event;
+
+        if (fread(record, 1, TRACE_FIELDS_SIZE + bodySize, in) != (size_t)(TRACE_FIELDS_SIZE + bodySize)) {
+            fprintf(stderr, "truncated after %u of %u events\n", i, count);
+            break;
+        }
+        parse(record, &event);
+        // micros() wraps after 71 minutes; the events are in order.
+        time += (i > 0) ? (uint32_t)(event.time - last) : event.time;
+        last = event.time;
+
+        if (listing) {
+            list(&event, time, bodySize);
+        } else {
+            writePcap(out, &event, time, (uint8_t)i, bodySize);
+        }
+    }
+
+    fclose(in);
+    if (out != NULL) {
+        fclose(out);
+    }
+
+    return EXIT_SUCCESS;
+}
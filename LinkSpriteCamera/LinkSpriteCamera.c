@@ -8,6 +8,53 @@
 #define CAMERA_SERIAL	Serial3
 #endif /* CAMERA_SERIAL */	
 
+// ms to sleep while no byte has arrived from the camera. The RX buffer of
+// CAMERA_SERIAL must hold the bytes that arrive meanwhile.
+#ifndef CAMERA_SERIAL_IDLE_TIME
+#define CAMERA_SERIAL_IDLE_TIME	(1)
+#endif /* CAMERA_SERIAL_IDLE_TIME */
+
+// ms without a byte from the camera after which an operation fails.
+#ifndef CAMERA_TIMEOUT
+#define CAMERA_TIMEOUT	(1000)
+#endif /* CAMERA_TIMEOUT */
+
+// ms which begin waits for an answer at the cached rate. The size of the
+// picture comes back within a few ms.
+#ifndef CAMERA_PROBE_TIMEOUT
+#define CAMERA_PROBE_TIMEOUT	(50)
+#endif /* CAMERA_PROBE_TIMEOUT */
+
+// The camera reads from addresses and in lengths which are multiples of
+// this. Other chunks are read from the aligned block around them.
+#ifndef CAMERA_READ_ALIGNMENT
+#define CAMERA_READ_ALIGNMENT	(8)
+#endif /* CAMERA_READ_ALIGNMENT */
+
+// ms which a chunk of getOptimalChunkSize may take on the UART, which is as
+// long as a blocking readData holds up the main loop.
+#ifndef CAMERA_CHUNK_TIME
+#define CAMERA_CHUNK_TIME	(250)
+#endif /* CAMERA_CHUNK_TIME */
+
+#define CAMERA_RESPONSE_SIZE	(5)
+#define CAMERA_SIZE_RESPONSE_SIZE	(9)
+
+// The command of an operation which is waiting for its answer
+typedef enum {
+	CAMERA_STEP_NONE = 0,
+	CAMERA_STEP_CAPTURE,
+	CAMERA_STEP_GET_SIZE,
+	CAMERA_STEP_READ,
+	CAMERA_STEP_STOP,
+	CAMERA_STEP_COMMAND
+} CameraStep;
+
+// The rates which negotiateBaudRate steps through, from the slowest
+static const uint32_t __camera_baudRates[] = {
+	CAMERA_BAUD_9600, CAMERA_BAUD_19200, CAMERA_BAUD_38400, CAMERA_BAUD_57600, CAMERA_BAUD_115200
+};
+
 static void LinkSpriteCamera_begin(uint32_t baud_rate);
 static void LinkSpriteCamera_end();
 static void LinkSpriteCamera_reset();
@@ -21,14 +68,59 @@ static void LinkSpriteCamera_quitPowerSaving();
 static void LinkSpriteCamera_setCompressionRatio(uint8_t ratio);
 static void LinkSpriteCamera_setBaudRate(uint32_t baud_rate);
 static void LinkSpriteCamera_setSize(ImageSize size);
-static void LinkSpriteCamera_sendCommand(const uint8_t cmd[], size_t cmdLen, uint8_t res[], size_t resLen);
+static size_t LinkSpriteCamera_receive(uint8_t buf[], size_t size);
+static bool LinkSpriteCamera_receiveLine(uint8_t line[], size_t size);
+static int LinkSpriteCamera_startPicture(CameraCallback callback);
+static int LinkSpriteCamera_startReadData(uint8_t* data, size_t read_size, CameraCallback callback);
+static int LinkSpriteCamera_startStopPicture(CameraCallback callback);
+static CameraStatus LinkSpriteCamera_poll();
+static CameraStatus LinkSpriteCamera_getStatus();
+static size_t LinkSpriteCamera_getResult();
+static size_t LinkSpriteCamera_getOptimalChunkSize(size_t limit);
+static uint32_t LinkSpriteCamera_negotiateBaudRate(uint32_t max_baud_rate);
+static uint32_t LinkSpriteCamera_getThroughput();
+static size_t LinkSpriteCamera_readAt(size_t offset, uint8_t* data, size_t read_size);
+static int LinkSpriteCamera_startReadAt(size_t offset, uint8_t* data, size_t read_size, CameraCallback callback);
+static bool LinkSpriteCamera_isFrameHeld();
+static int LinkSpriteCamera_start(CameraCallback callback);
+static int LinkSpriteCamera_startRead(size_t offset, uint8_t* data, size_t read_size, bool cursor, CameraCallback callback);
+static void LinkSpriteCamera_startStep(CameraStep step, const uint8_t cmd[], size_t cmdLen, size_t resLen);
+static void LinkSpriteCamera_finishStep();
+static void LinkSpriteCamera_complete(CameraStatus status, size_t result);
+static CameraStatus LinkSpriteCamera_wait();
+static CameraStatus LinkSpriteCamera_execute(const uint8_t cmd[], size_t cmdLen, size_t resLen);
+static void LinkSpriteCamera_open(uint32_t baud_rate);
+static bool LinkSpriteCamera_probe();
+static bool LinkSpriteCamera_switchBaudRate(uint32_t baud_rate);
 
 static uint32_t LinkSpriteCamera_toSerialBaud(uint32_t baud);
 
 static uint32_t __camera_serial_baudrate = DEFAULT_CAMERA_SERIAL_BAUD_RATE;
-static int	__camera_address;
+static uint32_t __camera_baudrate = CAMERA_BAUD_38400;
+static uint32_t __camera_cachedBaudrate;
+static size_t __camera_address;
 static bool __camera_eof;
-static int __camera_imageSize;
+static size_t __camera_imageSize;
+static bool __camera_frameHeld;
+
+static CameraStatus __camera_status;
+static CameraStep __camera_step;
+static CameraCallback __camera_callback;
+static size_t __camera_result;
+static uint8_t __camera_command;
+static uint8_t __camera_response[CAMERA_SIZE_RESPONSE_SIZE];
+static size_t __camera_responseSize;
+static size_t __camera_responseCount;
+static uint8_t *__camera_data;
+static size_t __camera_dataSize;
+static size_t __camera_dataCount;
+static bool __camera_cursor;
+static size_t __camera_lead;
+static size_t __camera_skip;
+static uint32_t __camera_lastRx;
+static uint32_t __camera_timeout = CAMERA_TIMEOUT;
+static uint32_t __camera_readStart;
+static uint32_t __camera_readTime;
 
 const LinkSpriteCamera Camera = {
 	LinkSpriteCamera_begin,
@@ -43,15 +135,41 @@ const LinkSpriteCamera Camera = {
 	LinkSpriteCamera_quitPowerSaving,
 	LinkSpriteCamera_setCompressionRatio,
 	LinkSpriteCamera_setBaudRate,
-	LinkSpriteCamera_setSize
+	LinkSpriteCamera_setSize,
+	LinkSpriteCamera_startPicture,
+	LinkSpriteCamera_startReadData,
+	LinkSpriteCamera_startStopPicture,
+	LinkSpriteCamera_poll,
+	LinkSpriteCamera_getStatus,
+	LinkSpriteCamera_getResult,
+	LinkSpriteCamera_getOptimalChunkSize,
+	LinkSpriteCamera_negotiateBaudRate,
+	LinkSpriteCamera_getThroughput,
+	LinkSpriteCamera_readAt,
+	LinkSpriteCamera_startReadAt,
+	LinkSpriteCamera_isFrameHeld
 };
 
 void LinkSpriteCamera_begin(uint32_t baud_rate)
 {
-	uint32_t serial_baud = LinkSpriteCamera_toSerialBaud(baud_rate);
-	CAMERA_SERIAL.begin(serial_baud);
-	__camera_serial_baudrate = serial_baud;
-	sleep(1);
+	bool found;
+
+	// The camera keeps the rate set last until it is powered off, so that
+	// rate is tried first. The cache is in RAM only, and a camera which has
+	// been powered off meanwhile costs CAMERA_PROBE_TIMEOUT ms.
+	if ((__camera_cachedBaudrate != 0) && (__camera_cachedBaudrate != baud_rate)) {
+		LinkSpriteCamera_open(__camera_cachedBaudrate);
+		__camera_timeout = CAMERA_PROBE_TIMEOUT;
+		found = LinkSpriteCamera_probe();
+		__camera_timeout = CAMERA_TIMEOUT;
+		if (found) {
+			LinkSpriteCamera_reset();
+			return;
+		}
+		CAMERA_SERIAL.end();
+	}
+
+	LinkSpriteCamera_open(baud_rate);
 	LinkSpriteCamera_reset();
 }
 
@@ -70,55 +188,38 @@ void LinkSpriteCamera_reset()
 	while (CAMERA_SERIAL.available() > 0)
 		CAMERA_SERIAL.read();
 
+	__camera_frameHeld = false;
 	DEBUG_PRINT("Resetting the camera...");
 
 	// Reset the camera
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, 4);
-
-#ifndef NDEBUG
-	{
-		const uint8_t match[] = { 0x76, 0x00, 0x26, 0x00 };
-		assert(memcmp(res, match, 4) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), 4) != CAMERA_DONE) {
+		DEBUG_PRINT("Resetting the camera failed.");
+		return;
 	}
-#endif /* NDEBUG */
 
 	do {
-		size_t count;
-		for (count = 0; (sizeof(res) - count) > 0;) {
-			int data;
-			data = CAMERA_SERIAL.read();
-			if (data == -1) continue;
-			if ((char)data == '\n') break;
-			res[count] = (uint8_t)data;
-			count++;
+		if (!LinkSpriteCamera_receiveLine(res, sizeof(res))) {
+			DEBUG_PRINT("The camera does not finish its reset.");
+			return;
 		}
-		if (count >= sizeof(res)) {
-		 	count = sizeof(res) - 1;
-		}
-		res[count] = 0;
 		DEBUG_PRINT(res);
 	} while(strcmp(initEnd, res) != 0);
-	assert(strcmp(initEnd, res) == 0);
 
 	DEBUG_PRINT("Resetting the camera is done.");
 }
 
+// Returns 0 if the camera does not answer.
 int LinkSpriteCamera_getSize()
 {
 	const uint8_t cmd[] = {0x56, 0x00, 0x34, 0x01, 0x00};
-	uint8_t res[9];
-	int fileSize = 0;
+	size_t fileSize;
 
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const uint8_t match[] = {0x76, 0x00, 0x34, 0x00, 0x04, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res) - 2) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_SIZE_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Reading the size failed.");
+		return 0;
 	}
-#endif /* NDEBUG */
 
-	fileSize = (res[7] << 8);
-	fileSize += res[8];
+	fileSize = ((size_t)__camera_response[7] << 8) | __camera_response[8];
 
 #ifndef NDEBUG
 	Serial.print("filesize=");
@@ -126,134 +227,48 @@ int LinkSpriteCamera_getSize()
 	Serial.flush();
 #endif /* NDEBUG */
 
-	return fileSize;
+	return (int)fileSize;
 }
 
 void LinkSpriteCamera_takePicture()
 {
-	const uint8_t cmd[] = {0x56, 0x00, 0x36, 0x01, 0x00};
-	uint8_t res[5];
-
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const uint8_t match[] = {0x76, 0x00, 0x36, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	LinkSpriteCamera_wait();
+	if ((LinkSpriteCamera_startPicture(NULL) != 0) || (LinkSpriteCamera_wait() != CAMERA_DONE)) {
+		DEBUG_PRINT("Capturing a picture failed.");
+		return;
 	}
-#endif /* NDEBUG */
-
-	__camera_eof = false;
-	__camera_address = 0;
-	__camera_imageSize = LinkSpriteCamera_getSize();
 
 	DEBUG_PRINT("Captured a picture.");
 }
 
 void LinkSpriteCamera_stopPicture()
 {
-	const uint8_t cmd[] = {0x56, 0x00, 0x36, 0x01, 0x03};
-	uint8_t res[5];
-
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const uint8_t match[] = { 0x76, 0x00, 0x36, 0x00, 0x00 };
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	LinkSpriteCamera_wait();
+	if (LinkSpriteCamera_startStopPicture(NULL) == 0) {
+		LinkSpriteCamera_wait();
 	}
-#endif /* NDEBUG */
 }
 
 size_t LinkSpriteCamera_readData(uint8_t* data, size_t read_size)
 {
-	size_t readBytes;
-	
-	read_size = read_size & ~0x07;
-#ifndef NDEBUG
-	DEBUG_PRINT("readData");
-	Serial.print("read_size=");
-	Serial.println_long((long)read_size, DEC);
-#endif /* NDEBUG */
-
-	{
-		const uint8_t cmd[] = {0x56, 0x00, 0x32, 0x0c, 0x00, 0x0a, 0x00, 0x00};
-		uint8_t res[5];
-		size_t count;
-
-		DEBUG_PRINT("camera_address=");
-		DEBUG_PRINT_LONG(__camera_address >> 8, HEX);
-		DEBUG_PRINT_LONG(__camera_address & 0xff, HEX);
-		DEBUG_PRINT("read_size=");
-		DEBUG_PRINT_LONG(read_size >> 8, HEX);
-		DEBUG_PRINT_LONG(read_size & 0xff, HEX);
-		CAMERA_SERIAL.write(cmd, sizeof(cmd));
-		CAMERA_SERIAL.write_byte((uint8_t)(__camera_address >> 8));
-		CAMERA_SERIAL.write_byte((uint8_t)(__camera_address & 0xff));
-		CAMERA_SERIAL.write_byte((uint8_t)0x00);
-		CAMERA_SERIAL.write_byte((uint8_t)0x00);
-		CAMERA_SERIAL.write_byte((uint8_t)(read_size >> 8));
-		CAMERA_SERIAL.write_byte((uint8_t)(read_size & 0xff));
-		CAMERA_SERIAL.write_byte((uint8_t)0x00);
-		CAMERA_SERIAL.write_byte((uint8_t)0x64);
-		// CAMERA_SERIAL.flush();
-
-		// wait for 0x0a times 0.01 msec
-		// delay(1);
-
-		// Read response of the Read JPEG file content command
-		for (count = 0; count < sizeof(res);) {
-			int data = CAMERA_SERIAL.read();
-			if (data == -1) continue;
-			res[count] = (uint8_t)data;
-			// DEBUG_PRINT_LONG(res[count], HEX);
-			count++;
-		}
-
-#ifndef NDEBUG
-		{
-			const char match[] = {0x76, 0x00, 0x32, 0x00, 0x00};
-			assert(memcmp(res, match, sizeof(res)) == 0);
-		}
-#endif /* NDEBUG */
+	LinkSpriteCamera_wait();
+	if ((LinkSpriteCamera_startReadData(data, read_size, NULL) != 0) || (LinkSpriteCamera_wait() != CAMERA_DONE)) {
+		return 0;
 	}
 
-	{
-		size_t len;
-		size_t size = ((size_t)(__camera_imageSize - __camera_address) > read_size) ? read_size : (size_t)(__camera_imageSize - __camera_address);
-		for (readBytes = 0; readBytes < size;) {
-			int ch;
-			ch = CAMERA_SERIAL.read();
-			if (ch == -1) continue;
-			data[readBytes] = (uint8_t)ch;
-			readBytes++;
-		}
-		__camera_address += readBytes;
-
-	#ifndef NDEBUG
-		Serial.print("Read bytes=");
-		Serial.print_long((long)readBytes, DEC);
-		Serial.print(" Address=");
-		Serial.print_long((long)__camera_address, DEC);
-		Serial.print(" Image data remaining=");
-		Serial.println_long((long)(__camera_imageSize - __camera_address), DEC);
-	#endif /* NDEBUG */
-
-		if ((data[readBytes - 1] == 0xD9) && (data[readBytes - 2] == 0xFF)) {
-			__camera_eof = true;
-	#ifndef NDEBUG
-			Serial.println("=== EOF ===");
-	#endif /* NDEBUG */
-		}
+	return __camera_result;
+}
 
-		// 5 for 0x76, 0x00, 0x32, 0x00, 0x00
-		for (len = 0; len < read_size - size + 5; ) {
-			int ch;
-			ch = CAMERA_SERIAL.read();
-			if (ch == -1) continue;
-			++len;
-		}
+// Reads from any offset of the picture which is held, without moving the
+// position of readData. Returns 0 if no picture is held.
+size_t LinkSpriteCamera_readAt(size_t offset, uint8_t* data, size_t read_size)
+{
+	LinkSpriteCamera_wait();
+	if ((LinkSpriteCamera_startReadAt(offset, data, read_size, NULL) != 0) || (LinkSpriteCamera_wait() != CAMERA_DONE)) {
+		return 0;
 	}
-	
-	return readBytes;
+
+	return __camera_result;
 }
 
 bool LinkSpriteCamera_isEOF()
@@ -264,117 +279,485 @@ bool LinkSpriteCamera_isEOF()
 void LinkSpriteCamera_enterPowerSaving()
 {
 	const uint8_t cmd[] = {0x56, 0x00, 0x3E, 0x03, 0x00, 0x01, 0x01};
-	uint8_t res[5];
 
 	DEBUG_PRINT("enterPowerSaving");
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const char match[] = {0x76, 0x00, 0x3E, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Entering power saving failed.");
 	}
-#endif /* NDEBUG */
 	CAMERA_SERIAL.end();
 }
 
 void LinkSpriteCamera_quitPowerSaving()
 {
 	const uint8_t cmd[] = {0x56, 0x00, 0x3E, 0x03, 0x00, 0x01, 0x00};
-	uint8_t res[5];
 
 	DEBUG_PRINT("quitPowerSaving");
 	CAMERA_SERIAL.begin(__camera_serial_baudrate);
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const char match[] = {0x76, 0x00, 0x3E, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Quitting power saving failed.");
 	}
-#endif /* NDEBUG */
 }
 
 void LinkSpriteCamera_setCompressionRatio(uint8_t ratio)
 {
-	uint8_t res[5];
 	uint8_t cmd[] = {0x56, 0x00, 0x31, 0x05, 0x01, 0x01, 0x12, 0x04, 0x00};
 
 	cmd[sizeof(cmd) - 1] = ratio;
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const char match[] = {0x76, 0x00, 0x31, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Setting the compression ratio failed.");
 	}
-#endif /* NDEBUG */
 }
 
 void LinkSpriteCamera_setBaudRate(uint32_t baud_rate)
 {
 	uint32_t serialBaud = LinkSpriteCamera_toSerialBaud(baud_rate);
 	uint8_t cmd[] = {0x56, 0x00, 0x24, 0x03, 0x01, 0x00, 0x00};
-	uint8_t res[5];
 
 	cmd[sizeof(cmd) - 2] = (uint8_t)(baud_rate >> 8);
 	cmd[sizeof(cmd) - 1] = (uint8_t)(baud_rate & 0xff);
 	
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const char match[] = {0x76, 0x00, 0x24, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Setting the baud rate failed.");
 	}
-#endif /* NDEBUG */
 
 	CAMERA_SERIAL.end();
 	CAMERA_SERIAL.begin(serialBaud);
 	__camera_serial_baudrate = serialBaud;
+	__camera_baudrate = baud_rate;
+	__camera_cachedBaudrate = baud_rate;
 	sleep(1);
 }
 
 void LinkSpriteCamera_setSize(ImageSize size)
 {
 	uint8_t cmd[] = {0x56, 0x00, 0x31, 0x05, 0x04, 0x01, 0x00, 0x19, 0x00};
-	uint8_t res[5];
 
 	cmd[sizeof(cmd) - 1] = (uint8_t)size;
-	LinkSpriteCamera_sendCommand(cmd, sizeof(cmd), res, sizeof(res));
-#ifndef NDEBUG
-	{
-		const char match[] = {0x76, 0x00, 0x31, 0x00, 0x00};
-		assert(memcmp(res, match, sizeof(res)) == 0);
+	if (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE) != CAMERA_DONE) {
+		DEBUG_PRINT("Setting the image size failed.");
 	}
-#endif /* NDEBUG */
 
 	LinkSpriteCamera_reset();
 }
 
-void LinkSpriteCamera_sendCommand(const uint8_t cmd[], size_t cmdLen, uint8_t res[], size_t resLen)
+// Moves the bytes which have already arrived, up to size, from the RX buffer
+// of CAMERA_SERIAL into buf, or drops them if buf is NULL. Does not wait.
+size_t LinkSpriteCamera_receive(uint8_t buf[], size_t size)
 {
+	int available = CAMERA_SERIAL.available();
 	size_t count;
 
-	#ifndef NDEBUG
-	Serial.print("Link Sprite Camera Command = ");
-	Serial.write(cmd, cmdLen);
-	Serial.println("");
-	#endif /* NDEBUG */
+	if (available <= 0) {
+		return 0;
+	}
+	if ((size_t)available < size) {
+		size = (size_t)available;
+	}
+
+	if (buf == NULL) {
+		for (count = 0; count < size; count++) {
+			CAMERA_SERIAL.read();
+		}
+	} else {
+		for (count = 0; count < size; count++) {
+			buf[count] = (uint8_t)CAMERA_SERIAL.read();
+		}
+	}
+
+	return size;
+}
+
+// Receives a line without '\n' and terminates it. A longer line is cut to
+// size - 1 bytes. Returns false if no byte arrives for CAMERA_TIMEOUT ms.
+bool LinkSpriteCamera_receiveLine(uint8_t line[], size_t size)
+{
+	size_t count = 0;
+	uint32_t lastRx = millis();
+
+	for (;;) {
+		int available = CAMERA_SERIAL.available();
+
+		if (available <= 0) {
+			if ((millis() - lastRx) > CAMERA_TIMEOUT) {
+				line[count] = 0;
+				return false;
+			}
+			sleep(CAMERA_SERIAL_IDLE_TIME);
+			continue;
+		}
+		lastRx = millis();
+		while (available-- > 0) {
+			uint8_t data = (uint8_t)CAMERA_SERIAL.read();
+			if (data == '\n') {
+				line[count] = 0;
+				return true;
+			}
+			if (count < size - 1) {
+				line[count++] = data;
+			}
+		}
+	}
+}
+
+int LinkSpriteCamera_startPicture(CameraCallback callback)
+{
+	const uint8_t cmd[] = {0x56, 0x00, 0x36, 0x01, 0x00};
+
+	if (LinkSpriteCamera_start(callback) != 0) {
+		return -1;
+	}
+	__camera_frameHeld = false;
+	LinkSpriteCamera_startStep(CAMERA_STEP_CAPTURE, cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE);
+
+	return 0;
+}
+
+int LinkSpriteCamera_startReadData(uint8_t* data, size_t read_size, CameraCallback callback)
+{
+	return LinkSpriteCamera_startRead(__camera_address, data, read_size, true, callback);
+}
+
+int LinkSpriteCamera_startReadAt(size_t offset, uint8_t* data, size_t read_size, CameraCallback callback)
+{
+	if (!__camera_frameHeld || (offset >= __camera_imageSize)) {
+		return -1;
+	}
+
+	return LinkSpriteCamera_startRead(offset, data, read_size, false, callback);
+}
+
+// Reads from offset. Only the reads of readData move its position and find
+// the end of the picture.
+int LinkSpriteCamera_startRead(size_t offset, uint8_t* data, size_t read_size, bool cursor, CameraCallback callback)
+{
+	uint8_t cmd[] = {0x56, 0x00, 0x32, 0x0c, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64};
+	size_t size;
+	size_t lead;
+	uint32_t address;
+	uint32_t length;
+
+	if ((read_size == 0) || (LinkSpriteCamera_start(callback) != 0)) {
+		return -1;
+	}
+
+	// Only the rest of the picture is requested, from the aligned block
+	// around it.
+	size = (__camera_imageSize - offset > read_size) ? read_size : __camera_imageSize - offset;
+	lead = offset % CAMERA_READ_ALIGNMENT;
+	address = (uint32_t)(offset - lead);
+	length = (uint32_t)(lead + size);
+	length += (CAMERA_READ_ALIGNMENT - length % CAMERA_READ_ALIGNMENT) % CAMERA_READ_ALIGNMENT;
+
+	cmd[6] = (uint8_t)(address >> 24);
+	cmd[7] = (uint8_t)(address >> 16);
+	cmd[8] = (uint8_t)(address >> 8);
+	cmd[9] = (uint8_t)(address & 0xff);
+	cmd[10] = (uint8_t)(length >> 24);
+	cmd[11] = (uint8_t)(length >> 16);
+	cmd[12] = (uint8_t)(length >> 8);
+	cmd[13] = (uint8_t)(length & 0xff);
+
+	// The camera sends length bytes, padded past the end of the picture,
+	// and repeats the 5 bytes of its answer after them.
+	if (cursor && (offset == 0)) {
+		__camera_readStart = micros();
+	}
+	LinkSpriteCamera_startStep(CAMERA_STEP_READ, cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE);
+	__camera_data = data;
+	__camera_dataSize = size;
+	__camera_cursor = cursor;
+	__camera_lead = lead;
+	__camera_skip = (size_t)length - lead - size + CAMERA_RESPONSE_SIZE;
+
+	return 0;
+}
+
+int LinkSpriteCamera_startStopPicture(CameraCallback callback)
+{
+	const uint8_t cmd[] = {0x56, 0x00, 0x36, 0x01, 0x03};
+
+	if (LinkSpriteCamera_start(callback) != 0) {
+		return -1;
+	}
+	__camera_frameHeld = false;
+	LinkSpriteCamera_startStep(CAMERA_STEP_STOP, cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE);
+
+	return 0;
+}
+
+// Takes the bytes which have arrived and moves the operation on. Returns
+// CAMERA_BUSY until it is over.
+CameraStatus LinkSpriteCamera_poll()
+{
+	size_t received = 0;
+
+	if (__camera_status != CAMERA_BUSY) {
+		return __camera_status;
+	}
+
+	if (__camera_responseCount < __camera_responseSize) {
+		size_t count = LinkSpriteCamera_receive(&__camera_response[__camera_responseCount], __camera_responseSize - __camera_responseCount);
+		__camera_responseCount += count;
+		received += count;
+	}
+	if ((__camera_responseCount == __camera_responseSize) && (__camera_lead > 0)) {
+		size_t count = LinkSpriteCamera_receive(NULL, __camera_lead);
+		__camera_lead -= count;
+		received += count;
+	}
+	if ((__camera_responseCount == __camera_responseSize) && (__camera_lead == 0) && (__camera_dataCount < __camera_dataSize)) {
+		size_t count = LinkSpriteCamera_receive(&__camera_data[__camera_dataCount], __camera_dataSize - __camera_dataCount);
+		__camera_dataCount += count;
+		received += count;
+	}
+	if ((__camera_responseCount == __camera_responseSize) && (__camera_lead == 0) && (__camera_dataCount == __camera_dataSize) && (__camera_skip > 0)) {
+		size_t count = LinkSpriteCamera_receive(NULL, __camera_skip);
+		__camera_skip -= count;
+		received += count;
+	}
+
+	if ((__camera_responseCount == __camera_responseSize) && (__camera_lead == 0) && (__camera_dataCount == __camera_dataSize) && (__camera_skip == 0)) {
+		LinkSpriteCamera_finishStep();
+	} else if (received > 0) {
+		__camera_lastRx = millis();
+	} else if ((millis() - __camera_lastRx) > __camera_timeout) {
+		DEBUG_PRINT("The camera does not answer.");
+		LinkSpriteCamera_complete(CAMERA_ERROR, 0);
+	}
+
+	return __camera_status;
+}
+
+CameraStatus LinkSpriteCamera_getStatus()
+{
+	return __camera_status;
+}
+
+size_t LinkSpriteCamera_getResult()
+{
+	return __camera_result;
+}
+
+// A picture is held from when startPicture is done until stopPicture or a
+// reset. Its bytes can be read with readAt meanwhile.
+bool LinkSpriteCamera_isFrameHeld()
+{
+	return __camera_frameHeld;
+}
+
+// Every read costs a 16-byte command, two 5-byte answers and the delay of
+// the camera, so larger chunks are cheaper per byte. A chunk is as large as
+// the UART carries in CAMERA_CHUNK_TIME ms at the current baud rate,
+// rounded down to CAMERA_READ_ALIGNMENT, but at most limit, such as the
+// payload of a radio frame. A limit within that is returned as it is, since
+// reads take any length, so that the chunk fills the frame.
+size_t LinkSpriteCamera_getOptimalChunkSize(size_t limit)
+{
+	uint32_t size = __camera_serial_baudrate / 10 * CAMERA_CHUNK_TIME / 1000;
+
+	size -= size % CAMERA_READ_ALIGNMENT;
+	if (size < CAMERA_READ_ALIGNMENT) {
+		size = CAMERA_READ_ALIGNMENT;
+	}
+	if (size > limit) {
+		size = (uint32_t)limit;
+	}
+
+	return (size_t)size;
+}
+
+// Steps up from the current rate through the faster ones up to
+// max_baud_rate, and checks every step with a command. A step which fails
+// goes back to the last rate which worked. Returns that rate, or 0 if the
+// camera does not answer at all.
+uint32_t LinkSpriteCamera_negotiateBaudRate(uint32_t max_baud_rate)
+{
+	uint32_t max = LinkSpriteCamera_toSerialBaud(max_baud_rate);
+	uint32_t current = __camera_baudrate;
+	size_t i;
+
+	LinkSpriteCamera_wait();
+	for (i = 0; i < sizeof(__camera_baudRates) / sizeof(__camera_baudRates[0]); i++) {
+		uint32_t serialBaud = LinkSpriteCamera_toSerialBaud(__camera_baudRates[i]);
+
+		if ((serialBaud <= __camera_serial_baudrate) || (serialBaud > max)) {
+			continue;
+		}
+		if (LinkSpriteCamera_switchBaudRate(__camera_baudRates[i])) {
+			current = __camera_baudRates[i];
+			continue;
+		}
+
+		DEBUG_PRINT("Falling back to the last baud rate.");
+		if (!LinkSpriteCamera_switchBaudRate(current)) {
+			__camera_cachedBaudrate = 0;
+			return 0;
+		}
+		break;
+	}
+
+	__camera_cachedBaudrate = current;
+	return current;
+}
+
+// Bytes per second with which the last picture was read, from the command
+// of its first chunk until its end. 0 until the end has been read.
+uint32_t LinkSpriteCamera_getThroughput()
+{
+	if (__camera_readTime < 1000) {
+		return 0;
+	}
+
+	return (uint32_t)((uint64_t)__camera_address * 1000000 / __camera_readTime);
+}
+
+int LinkSpriteCamera_start(CameraCallback callback)
+{
+	if (__camera_status == CAMERA_BUSY) {
+		return -1;
+	}
+
+	__camera_status = CAMERA_BUSY;
+	__camera_callback = callback;
+	__camera_result = 0;
+
+	return 0;
+}
+
+// Sends a command and waits for an answer of resLen bytes.
+void LinkSpriteCamera_startStep(CameraStep step, const uint8_t cmd[], size_t cmdLen, size_t resLen)
+{
+	__camera_step = step;
+	__camera_command = cmd[2];
+	__camera_responseSize = resLen;
+	__camera_responseCount = 0;
+	__camera_data = NULL;
+	__camera_dataSize = 0;
+	__camera_dataCount = 0;
+	__camera_lead = 0;
+	__camera_skip = 0;
+	__camera_lastRx = millis();
 
 	CAMERA_SERIAL.write(cmd, cmdLen);
-	CAMERA_SERIAL.flush();
-
-	for (count = 0; (resLen - count) > 0;) {
-		int data = CAMERA_SERIAL.read();
-		if (data == -1) continue;
-		res[count] = (uint8_t)data;
-		DEBUG_PRINT_LONG(res[count], HEX);
-		count++;
-	}
-
-	#ifndef NDEBUG
-	Serial.println("");
-	Serial.print("Result = ");
-	Serial.write(res, resLen);
-	Serial.println("");
-	#endif /* NDEBUG */
+}
+
+void LinkSpriteCamera_finishStep()
+{
+	if ((__camera_response[0] != 0x76) || (__camera_response[2] != __camera_command) || (__camera_response[3] != 0x00)) {
+		DEBUG_PRINT("Unexpected answer from the camera.");
+		LinkSpriteCamera_complete(CAMERA_ERROR, 0);
+		return;
+	}
+
+	switch (__camera_step) {
+		case CAMERA_STEP_CAPTURE: {
+			const uint8_t cmd[] = {0x56, 0x00, 0x34, 0x01, 0x00};
+
+			__camera_eof = false;
+			__camera_address = 0;
+			__camera_readTime = 0;
+			LinkSpriteCamera_startStep(CAMERA_STEP_GET_SIZE, cmd, sizeof(cmd), CAMERA_SIZE_RESPONSE_SIZE);
+			break;
+		}
+		case CAMERA_STEP_GET_SIZE:
+			// The size is unsigned, as pictures over 32767 bytes do not fit
+			// an int on 16-bit targets.
+			__camera_imageSize = ((size_t)__camera_response[7] << 8) | __camera_response[8];
+			__camera_frameHeld = true;
+			LinkSpriteCamera_complete(CAMERA_DONE, __camera_imageSize);
+			break;
+		case CAMERA_STEP_READ:
+			if (!__camera_cursor) {
+				LinkSpriteCamera_complete(CAMERA_DONE, __camera_dataSize);
+				break;
+			}
+			__camera_address += __camera_dataSize;
+			if ((__camera_address >= __camera_imageSize) ||
+				((__camera_dataSize >= 2) && (__camera_data[__camera_dataSize - 1] == 0xD9) && (__camera_data[__camera_dataSize - 2] == 0xFF))) {
+				__camera_eof = true;
+				__camera_readTime = micros() - __camera_readStart;
+			}
+			LinkSpriteCamera_complete(CAMERA_DONE, __camera_dataSize);
+			break;
+		default:
+			LinkSpriteCamera_complete(CAMERA_DONE, 0);
+			break;
+	}
+}
+
+void LinkSpriteCamera_complete(CameraStatus status, size_t result)
+{
+	__camera_step = CAMERA_STEP_NONE;
+	__camera_status = status;
+	__camera_result = result;
+	// The callback may start the next operation.
+	if (__camera_callback != NULL) {
+		__camera_callback(status, result);
+	}
+}
+
+// Polls until the operation in progress is over. poll() takes every byte
+// which has arrived, so it sleeps in between.
+CameraStatus LinkSpriteCamera_wait()
+{
+	CameraStatus status;
+
+	while ((status = LinkSpriteCamera_poll()) == CAMERA_BUSY) {
+		sleep(CAMERA_SERIAL_IDLE_TIME);
+	}
+
+	return status;
+}
+
+// Sends a command and waits for an answer of resLen bytes, for
+// CAMERA_TIMEOUT ms at most.
+CameraStatus LinkSpriteCamera_execute(const uint8_t cmd[], size_t cmdLen, size_t resLen)
+{
+	if (LinkSpriteCamera_start(NULL) != 0) {
+		return CAMERA_ERROR;
+	}
+	LinkSpriteCamera_startStep(CAMERA_STEP_COMMAND, cmd, cmdLen, resLen);
+
+	return LinkSpriteCamera_wait();
+}
+
+void LinkSpriteCamera_open(uint32_t baud_rate)
+{
+	uint32_t serialBaud = LinkSpriteCamera_toSerialBaud(baud_rate);
+
+	CAMERA_SERIAL.begin(serialBaud);
+	__camera_serial_baudrate = serialBaud;
+	__camera_baudrate = baud_rate;
+	sleep(1);
+}
+
+// Checks the link by reading the size of the picture, which has no effect
+// on the camera.
+bool LinkSpriteCamera_probe()
+{
+	const uint8_t cmd[] = {0x56, 0x00, 0x34, 0x01, 0x00};
+
+	while (CAMERA_SERIAL.available() > 0)
+		CAMERA_SERIAL.read();
+
+	return (LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_SIZE_RESPONSE_SIZE) == CAMERA_DONE);
+}
+
+// Sets the rate of the camera, which answers at the old one, follows it on
+// CAMERA_SERIAL and checks the link. The answer is not needed: the check
+// shows whether the camera has changed its rate.
+bool LinkSpriteCamera_switchBaudRate(uint32_t baud_rate)
+{
+	uint8_t cmd[] = {0x56, 0x00, 0x24, 0x03, 0x01, 0x00, 0x00};
+
+	cmd[sizeof(cmd) - 2] = (uint8_t)(baud_rate >> 8);
+	cmd[sizeof(cmd) - 1] = (uint8_t)(baud_rate & 0xff);
+	LinkSpriteCamera_execute(cmd, sizeof(cmd), CAMERA_RESPONSE_SIZE);
+
+	CAMERA_SERIAL.end();
+	LinkSpriteCamera_open(baud_rate);
+
+	return LinkSpriteCamera_probe();
 }
 
 uint32_t LinkSpriteCamera_toSerialBaud(uint32_t baud)
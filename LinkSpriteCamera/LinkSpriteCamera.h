@@ -15,6 +15,18 @@ typedef enum {
     QQVGA = 0x22
 } ImageSize;
 
+typedef enum {
+    CAMERA_IDLE = 0,
+    CAMERA_BUSY,
+    CAMERA_DONE,
+    CAMERA_ERROR
+} CameraStatus;
+
+// Called from poll() when an operation started with start* is over. result
+// is the image size for startPicture and the bytes read for startReadData
+// and startReadAt.
+typedef void (*CameraCallback)(CameraStatus status, size_t result);
+
 typedef struct {
 	void (*begin)(uint32_t baud_rate);
 	void (*end)();
@@ -29,6 +41,18 @@ typedef struct {
 	void (*setCompressionRatio)(uint8_t ratio);
 	void (*setBaudRate)(uint32_t baud_rate);
 	void (*setSize)(ImageSize size);
+	int (*startPicture)(CameraCallback callback);
+	int (*startReadData)(uint8_t* data, size_t read_size, CameraCallback callback);
+	int (*startStopPicture)(CameraCallback callback);
+	CameraStatus (*poll)();
+	CameraStatus (*getStatus)();
+	size_t (*getResult)();
+	size_t (*getOptimalChunkSize)(size_t limit);
+	uint32_t (*negotiateBaudRate)(uint32_t max_baud_rate);
+	uint32_t (*getThroughput)();
+	size_t (*readAt)(size_t offset, uint8_t* data, size_t read_size);
+	int (*startReadAt)(size_t offset, uint8_t* data, size_t read_size, CameraCallback callback);
+	bool (*isFrameHeld)();
 } LinkSpriteCamera;
 
 extern const LinkSpriteCamera Camera;